@@ -0,0 +1,32 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <stdint.h>
+
+// Microbenchmarks run by `make bench` (see bench/main.cpp). Each one prints
+// its own table; args are whatever followed its name on the command line.
+typedef std::vector<std::string> BenchArgs;
+
+uint64_t	bench_now_ns();
+// Runs fn(ctx, n) with growing n until a run takes at least minMs; returns
+// the time per iteration of that run in ns
+double		bench_ns_per_op(void (*fn)(void *ctx, size_t n), void *ctx, unsigned minMs = 200);
+// Numeric arguments, or the defaults when none were given
+std::vector<long>	bench_sizes(const BenchArgs &args, const long *defaults, size_t count);
+// Keeps a computed value alive so the loop producing it is not optimized out
+void		bench_keep(size_t v);
+// Lets the process open at least n more descriptors (soft RLIMIT_NOFILE)
+bool		bench_raise_fd_limit(size_t n);
+
+void	bench_poller(const BenchArgs &args);
+void	bench_interest(const BenchArgs &args);
+void	bench_dispatch(const BenchArgs &args);
+void	bench_multipart(const BenchArgs &args);
+void	bench_parser(const BenchArgs &args);
+void	bench_scan(const BenchArgs &args);
+void	bench_router(const BenchArgs &args);
+
+#endif
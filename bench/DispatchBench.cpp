@@ -0,0 +1,154 @@
+#include "Bench.hpp"
+
+#include <map>
+#include <cstdlib>
+
+// Resolving a ready fd to its handler, with n client fds, a few listeners
+// and one CGI pipe per ten clients. The old loop tried three std::maps in
+// turn (listeners, aux fds, clients); the loop now reads one slot of a
+// table indexed by fd. The slot mirrors EventLoop::Slot, which is private.
+struct Handler {
+	size_t	hits;
+};
+
+enum { KIND_FREE = 0, KIND_LISTEN, KIND_CLIENT, KIND_AUX };
+
+struct BenchSlot {
+	unsigned char	kind;
+	unsigned char	dirty;
+	short			interest;
+	int				listen;
+	Handler			*conn;
+	void			*gen;
+};
+
+static const int FIRST_FD = 8;
+static const int LISTENERS = 4;
+static const size_t BATCH = 64;
+
+struct DispatchCtx {
+	std::map<int, std::string>	listenKeys;
+	std::map<int, Handler*>		auxConns;
+	std::map<int, Handler*>		conns;
+	std::vector<BenchSlot>		slots;
+	std::vector<int>			ready;    // fds reported ready, cycled through
+	std::vector<Handler>		handlers;
+	size_t						pos;
+	int							churnFd;  // client fd accepted and closed
+};
+
+static void dispatch_maps(void *ctx, size_t n) {
+	DispatchCtx *t = static_cast<DispatchCtx*>(ctx);
+	for (size_t i = 0; i < n; ++i) {
+		for (size_t b = 0; b < BATCH; ++b) {
+			int fd = t->ready[(t->pos + b) & (t->ready.size() - 1)];
+			if (t->listenKeys.find(fd) != t->listenKeys.end()) {
+				++t->handlers[0].hits;
+				continue;
+			}
+			std::map<int, Handler*>::iterator ait = t->auxConns.find(fd);
+			if (ait != t->auxConns.end()) {
+				++ait->second->hits;
+				continue;
+			}
+			std::map<int, Handler*>::iterator it = t->conns.find(fd);
+			if (it != t->conns.end()) ++it->second->hits;
+		}
+		t->pos += BATCH;
+	}
+}
+
+static void dispatch_slots(void *ctx, size_t n) {
+	DispatchCtx *t = static_cast<DispatchCtx*>(ctx);
+	for (size_t i = 0; i < n; ++i) {
+		for (size_t b = 0; b < BATCH; ++b) {
+			int fd = t->ready[(t->pos + b) & (t->ready.size() - 1)];
+			if ((size_t)fd >= t->slots.size()) continue;
+			BenchSlot &s = t->slots[fd];
+			switch (s.kind) {
+			case KIND_LISTEN:
+				++t->handlers[0].hits;
+				break;
+			case KIND_AUX:
+			case KIND_CLIENT:
+				++s.conn->hits;
+				break;
+			}
+		}
+		t->pos += BATCH;
+	}
+}
+
+// One accept and one close of a client
+static void churn_maps(void *ctx, size_t n) {
+	DispatchCtx *t = static_cast<DispatchCtx*>(ctx);
+	for (size_t i = 0; i < n; ++i) {
+		t->conns[t->churnFd] = &t->handlers[0];
+		t->conns.erase(t->churnFd);
+	}
+}
+
+static void churn_slots(void *ctx, size_t n) {
+	DispatchCtx *t = static_cast<DispatchCtx*>(ctx);
+	for (size_t i = 0; i < n; ++i) {
+		BenchSlot &s = t->slots[t->churnFd];
+		s.kind = KIND_CLIENT;
+		s.conn = &t->handlers[0];
+		s.interest = 0;
+		s.dirty = 0;
+		bench_keep((size_t)s.kind);
+		s.kind = KIND_FREE;
+		s.conn = 0;
+	}
+}
+
+void bench_dispatch(const BenchArgs &args) {
+	static const long defaults[] = { 1000, 10000, 50000 };
+	std::vector<long> counts = bench_sizes(args, defaults, sizeof(defaults) / sizeof(defaults[0]));
+
+	std::printf("%8s %16s %16s %16s %16s\n", "fds", "maps ns/fd", "slots ns/fd", "maps ns/churn", "slots ns/churn");
+	for (size_t c = 0; c < counts.size(); ++c) {
+		const int clients = (int)counts[c];
+		const int aux = clients / 10;
+		const int total = LISTENERS + clients + aux;
+		DispatchCtx t;
+		t.handlers.resize(total + 1);
+		t.slots.resize(FIRST_FD + total + 1);
+		for (size_t s = 0; s < t.slots.size(); ++s) {
+			t.slots[s].kind = KIND_FREE;
+			t.slots[s].dirty = 0;
+			t.slots[s].interest = 0;
+			t.slots[s].listen = -1;
+			t.slots[s].conn = 0;
+			t.slots[s].gen = 0;
+		}
+		// Listeners first, then clients and their CGI pipes interleaved
+		int fd = FIRST_FD;
+		for (int l = 0; l < LISTENERS; ++l, ++fd) {
+			t.listenKeys[fd] = "127.0.0.1:8080";
+			t.slots[fd].kind = KIND_LISTEN;
+			t.slots[fd].listen = l;
+		}
+		for (int k = 0; k < clients + aux; ++k, ++fd) {
+			bool isAux = (k % 11) == 10;
+			Handler *h = &t.handlers[k + 1];
+			(isAux ? t.auxConns : t.conns)[fd] = h;
+			t.slots[fd].kind = isAux ? KIND_AUX : KIND_CLIENT;
+			t.slots[fd].conn = h;
+		}
+		t.churnFd = fd;
+		// Ready fds spread over the whole range, 2^16 of them so the batch
+		// walks memory rather than one hot cache line
+		std::srand(42);
+		for (size_t r = 0; r < 65536; ++r) t.ready.push_back(FIRST_FD + std::rand() % total);
+		t.pos = 0;
+		double maps = bench_ns_per_op(dispatch_maps, &t) / BATCH;
+		double slots = bench_ns_per_op(dispatch_slots, &t) / BATCH;
+		double mchurn = bench_ns_per_op(churn_maps, &t);
+		double schurn = bench_ns_per_op(churn_slots, &t);
+		size_t hits = 0;
+		for (size_t h = 0; h < t.handlers.size(); ++h) hits += t.handlers[h].hits;
+		bench_keep(hits);
+		std::printf("%8d %16.2f %16.2f %16.2f %16.2f\n", total, maps, slots, mchurn, schurn);
+	}
+}
@@ -0,0 +1,173 @@
+#include "Bench.hpp"
+#include "../inc/MultipartUpload.hpp"
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+
+// A multipart/form-data upload of `total` bytes split over `files` file
+// parts, produced 16 KB at a time as if read off the socket. File contents
+// come from a block of pseudo-random bytes, so CRs and dashes occur as in
+// binary uploads.
+static const char *BOUNDARY = "----webservBenchBoundary7MA4YWxkTrZu0gW";
+static const size_t READ_SIZE = 16384;
+
+class BodySource {
+public:
+	BodySource(size_t total, size_t files) : _seg(0), _off(0), _blockOff(0) {
+		_block.resize(1 << 20);
+		unsigned x = 2463534242u;
+		for (size_t i = 0; i < _block.size(); ++i) {
+			x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+			_block[i] = (char)(x & 0xff);
+		}
+		for (size_t f = 0; f < files; ++f) {
+			std::ostringstream head;
+			head << (f ? "\r\n" : "") << "--" << BOUNDARY << "\r\n"
+				 << "Content-Disposition: form-data; name=\"file" << f << "\"; filename=\"part" << f << ".bin\"\r\n"
+				 << "Content-Type: application/octet-stream\r\n\r\n";
+			push(head.str(), 0);
+			push(std::string(), total / files);
+		}
+		push(std::string("\r\n--") + BOUNDARY + "--\r\n", 0);
+	}
+
+	// Next slice of the body, 0 at the end
+	size_t read(char *buf, size_t n) {
+		size_t got = 0;
+		while (got < n && _seg < _segs.size()) {
+			const Segment &s = _segs[_seg];
+			size_t len = s.text.empty() ? s.fill : s.text.size();
+			size_t k = std::min(n - got, len - _off);
+			if (s.text.empty()) {
+				size_t b = std::min(k, _block.size() - _blockOff);
+				std::memcpy(buf + got, &_block[_blockOff], b);
+				_blockOff = (_blockOff + b) % _block.size();
+				k = b;
+			} else {
+				std::memcpy(buf + got, s.text.data() + _off, k);
+			}
+			got += k;
+			_off += k;
+			if (_off == len) {
+				++_seg;
+				_off = 0;
+			}
+		}
+		return got;
+	}
+
+private:
+	struct Segment {
+		std::string	text;
+		size_t		fill;  // random bytes when text is empty
+	};
+	std::vector<Segment>	_segs;
+	std::vector<char>		_block;
+	size_t					_seg;
+	size_t					_off;
+	size_t					_blockOff;
+
+	void push(const std::string &text, size_t fill) {
+		Segment s;
+		s.text = text;
+		s.fill = fill;
+		_segs.push_back(s);
+	}
+};
+
+static long max_rss_kb() {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+}
+
+static void clear_dir(const std::string &dir) {
+	DIR *d = ::opendir(dir.c_str());
+	if (!d) return;
+	struct dirent *e;
+	while ((e = ::readdir(d)) != 0) {
+		if (std::strcmp(e->d_name, ".") && std::strcmp(e->d_name, ".."))
+			::unlink((dir + "/" + e->d_name).c_str());
+	}
+	::closedir(d);
+}
+
+static bool run_streaming(const std::string &store, size_t total, size_t files, double *secs) {
+	MultipartUpload up;
+	std::string err;
+	bool bad = false;
+	BodySource body(total, files);
+	std::vector<char> buf(READ_SIZE);
+	uint64_t t0 = bench_now_ns();
+	if (!up.begin(store, std::string("multipart/form-data; boundary=") + BOUNDARY, &err)) return false;
+	for (size_t n; (n = body.read(&buf[0], buf.size())) > 0; ) {
+		if (!up.feed(&buf[0], n, &err, &bad)) return false;
+	}
+	if (!up.finish(&err, &bad) || up.files().size() != files) return false;
+	*secs = (double)(bench_now_ns() - t0) / 1e9;
+	return true;
+}
+
+// Reference: the handler this replaced buffered the whole body, then
+// searched it for delimiters and copied each part out before writing it
+// (it only ever saved the first file part).
+static bool run_buffered(const std::string &store, size_t total, size_t files, double *secs) {
+	BodySource body(total, files);
+	std::vector<char> buf(READ_SIZE);
+	uint64_t t0 = bench_now_ns();
+	std::string all;
+	for (size_t n; (n = body.read(&buf[0], buf.size())) > 0; ) all.append(&buf[0], n);
+	std::string bmark = std::string("--") + BOUNDARY;
+	std::string::size_type start = all.find(bmark);
+	if (start == std::string::npos) return false;
+	std::string::size_type hdrEnd = all.find("\r\n\r\n", start);
+	if (hdrEnd == std::string::npos) return false;
+	std::string::size_type next = all.find("\r\n" + bmark, hdrEnd + 4);
+	if (next == std::string::npos) return false;
+	std::string content = all.substr(hdrEnd + 4, next - hdrEnd - 4);
+	FILE *f = std::fopen((store + "/buffered.bin").c_str(), "wb");
+	if (!f) return false;
+	bool ok = std::fwrite(content.data(), 1, content.size(), f) == content.size();
+	ok = (std::fclose(f) == 0) && ok;
+	*secs = (double)(bench_now_ns() - t0) / 1e9;
+	return ok;
+}
+
+void bench_multipart(const BenchArgs &args) {
+	static const long defaults[] = { 1024 };
+	std::vector<long> sizes = bench_sizes(args, defaults, sizeof(defaults) / sizeof(defaults[0]));
+	const size_t files = 4;
+
+	char tmpl[] = "/tmp/webserv-bench-XXXXXX";
+	if (!::mkdtemp(tmpl)) {
+		std::printf("mkdtemp failed\n");
+		return;
+	}
+	const std::string store = tmpl;
+	std::printf("%8s %6s %14s %16s %14s %16s\n", "MB", "files", "stream MB/s", "stream RSS +MB",
+				"buffer MB/s", "buffer RSS +MB");
+	for (size_t i = 0; i < sizes.size(); ++i) {
+		const size_t total = (size_t)sizes[i] << 20;
+		double ss = 0, bs = 0;
+		long rss0 = max_rss_kb();
+		bool sok = run_streaming(store, total, files, &ss);
+		long rss1 = max_rss_kb();
+		clear_dir(store);
+		bool bok = run_buffered(store, total, files, &bs);
+		long rss2 = max_rss_kb();
+		clear_dir(store);
+		const double mb = (double)sizes[i];
+		std::printf("%8ld %6lu ", sizes[i], (unsigned long)files);
+		if (sok) std::printf("%14.1f %16.1f ", mb / ss, (double)(rss1 - rss0) / 1024.0);
+		else std::printf("%14s %16s ", "failed", "-");
+		if (bok) std::printf("%14.1f %16.1f\n", mb / bs, (double)(rss2 - rss1) / 1024.0);
+		else std::printf("%14s %16s\n", "failed", "-");
+	}
+	::rmdir(store.c_str());
+}
@@ -0,0 +1,278 @@
+#include "Bench.hpp"
+#include "../inc/HttpParser.hpp"
+#include "../inc/Scan.hpp"
+
+#include <map>
+#include <sstream>
+
+// Request heads as browsers send them
+static const char *BROWSER_GET =
+	"GET /images/places/paris.jpg?size=large&v=3 HTTP/1.1\r\n"
+	"Host: www.example.com\r\n"
+	"Connection: keep-alive\r\n"
+	"sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+	"sec-ch-ua-mobile: ?0\r\n"
+	"sec-ch-ua-platform: \"Linux\"\r\n"
+	"Upgrade-Insecure-Requests: 1\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+	"Sec-Fetch-Site: same-origin\r\n"
+	"Sec-Fetch-Mode: navigate\r\n"
+	"Sec-Fetch-User: ?1\r\n"
+	"Sec-Fetch-Dest: document\r\n"
+	"Referer: https://www.example.com/gallery/index.html\r\n"
+	"Accept-Encoding: gzip, deflate, br, zstd\r\n"
+	"Accept-Language: en-US,en;q=0.9,fr;q=0.8\r\n"
+	"Cookie: session=4f0c1e2a9b7d4c3e8f6a5b4c3d2e1f0a; theme=dark; _ga=GA1.1.123456789.1700000000\r\n"
+	"If-None-Match: \"5f3a-61b2c8e4d9a00\"\r\n"
+	"If-Modified-Since: Tue, 14 May 2024 09:12:44 GMT\r\n"
+	"\r\n";
+
+static const char *SMALL_GET =
+	"GET /health HTTP/1.1\r\n"
+	"Host: 10.0.0.12:8080\r\n"
+	"User-Agent: kube-probe/1.29\r\n"
+	"Accept: */*\r\n"
+	"Connection: close\r\n"
+	"\r\n";
+
+// Reference: the parser before the state machine. It searched the buffer
+// for CRLF from the start for each line, copied and erased every line,
+// split the request line with an istringstream and trimmed copies of the
+// header name and value into a std::map.
+class LegacyParser {
+public:
+	LegacyParser() : _haveStartLine(false) {}
+
+	void reset() {
+		_buf.clear();
+		_method.clear();
+		_target.clear();
+		_version.clear();
+		_headers.clear();
+		_haveStartLine = false;
+	}
+
+	bool feed(const char *data, size_t len) {
+		_buf.append(data, len);
+		if (!_haveStartLine) {
+			std::string::size_type pos = _buf.find("\r\n");
+			if (pos == std::string::npos) return false;
+			std::string line = _buf.substr(0, pos);
+			_buf.erase(0, pos + 2);
+			std::istringstream iss(line);
+			if (!(iss >> _method >> _target >> _version)) return false;
+			_haveStartLine = true;
+		}
+		for (;;) {
+			std::string::size_type pos = _buf.find("\r\n");
+			if (pos == std::string::npos) return false;
+			if (pos == 0) {
+				_buf.erase(0, 2);
+				return true;
+			}
+			std::string line = _buf.substr(0, pos);
+			_buf.erase(0, pos + 2);
+			std::string::size_type colon = line.find(":");
+			if (colon == std::string::npos) return false;
+			_headers[trim(line.substr(0, colon))] = trim(line.substr(colon + 1));
+		}
+	}
+
+	size_t headerCount() const { return _headers.size(); }
+
+private:
+	std::string	_buf;
+	std::string	_method;
+	std::string	_target;
+	std::string	_version;
+	std::map<std::string, std::string>	_headers;
+	bool		_haveStartLine;
+
+	static std::string trim(const std::string &s) {
+		size_t b = 0;
+		while (b < s.size() && (s[b] == ' ' || s[b] == '\t')) ++b;
+		size_t e = s.size();
+		while (e > b && (s[e - 1] == ' ' || s[e - 1] == '\t')) --e;
+		return s.substr(b, e - b);
+	}
+};
+
+struct ParseCtx {
+	std::string		req;
+	size_t			pieces;  // reads the head arrives in
+	HttpParser		parser;
+	LegacyParser	legacy;
+};
+
+// Splits the head into `pieces` reads of about equal size
+static size_t piece_end(const ParseCtx *t, size_t k) {
+	return (k + 1 == t->pieces) ? t->req.size() : t->req.size() * (k + 1) / t->pieces;
+}
+
+static void parse_current(void *ctx, size_t n) {
+	ParseCtx *t = static_cast<ParseCtx*>(ctx);
+	for (size_t i = 0; i < n; ++i) {
+		t->parser.reset();
+		size_t off = 0;
+		for (size_t k = 0; k < t->pieces; ++k) {
+			size_t end = piece_end(t, k);
+			t->parser.feed(t->req.data() + off, end - off);
+			off = end;
+		}
+		// The connection always materializes the request it routes
+		bench_keep(t->parser.request().headers.size());
+	}
+}
+
+static void parse_legacy(void *ctx, size_t n) {
+	ParseCtx *t = static_cast<ParseCtx*>(ctx);
+	for (size_t i = 0; i < n; ++i) {
+		t->legacy.reset();
+		size_t off = 0;
+		for (size_t k = 0; k < t->pieces; ++k) {
+			size_t end = piece_end(t, k);
+			t->legacy.feed(t->req.data() + off, end - off);
+			off = end;
+		}
+		bench_keep(t->legacy.headerCount());
+	}
+}
+
+void bench_parser(const BenchArgs &args) {
+	(void)args;
+	struct Case {
+		const char	*name;
+		const char	*req;
+		size_t		pieces;
+	};
+	static const Case cases[] = {
+		{ "browser GET", BROWSER_GET, 1 },
+		{ "browser GET, 4 reads", BROWSER_GET, 4 },
+		{ "probe GET", SMALL_GET, 1 },
+	};
+
+	std::printf("%-22s %6s %14s %14s %14s %14s\n", "request", "bytes", "parser ns", "parser req/s",
+				"legacy ns", "legacy req/s");
+	for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+		ParseCtx t;
+		t.req = cases[c].req;
+		t.pieces = cases[c].pieces;
+		t.parser.setLimits(8192, 8192, 100);
+		double cur = bench_ns_per_op(parse_current, &t);
+		double old = bench_ns_per_op(parse_legacy, &t);
+		std::printf("%-22s %6lu %14.1f %14.0f %14.1f %14.0f\n", cases[c].name, (unsigned long)t.req.size(),
+					cur, 1e9 / cur, old, 1e9 / old);
+	}
+}
+
+struct ScanCtx {
+	std::string	head;
+	HttpParser	parser;
+};
+
+// What the parser asks of the kernels on a head: every line end, and the
+// end of each header name
+static void scan_lines(void *ctx, size_t n) {
+	ScanCtx *t = static_cast<ScanCtx*>(ctx);
+	const char *p = t->head.data();
+	size_t len = t->head.size();
+	for (size_t i = 0; i < n; ++i) {
+		size_t off = 0, sum = 0;
+		while (off < len) {
+			size_t eol = off + scan_crlf(p + off, len - off);
+			sum += scan_token_end(p + off, eol - off);
+			off = eol + 2;
+		}
+		bench_keep(sum);
+	}
+}
+
+// Same walk with std::string::find and a strchr-style name loop
+static void scan_lines_find(void *ctx, size_t n) {
+	ScanCtx *t = static_cast<ScanCtx*>(ctx);
+	for (size_t i = 0; i < n; ++i) {
+		size_t off = 0, sum = 0;
+		while (off < t->head.size()) {
+			size_t eol = t->head.find("\r\n", off);
+			if (eol == std::string::npos) eol = t->head.size();
+			size_t colon = t->head.find(':', off);
+			sum += (colon < eol ? colon : eol) - off;
+			off = eol + 2;
+		}
+		bench_keep(sum);
+	}
+}
+
+// One long run with no line end, as in a large chunk of body data
+static void scan_run(void *ctx, size_t n) {
+	ScanCtx *t = static_cast<ScanCtx*>(ctx);
+	for (size_t i = 0; i < n; ++i)
+		bench_keep(scan_line_end(t->head.data(), t->head.size()));
+}
+
+static void scan_run_find(void *ctx, size_t n) {
+	ScanCtx *t = static_cast<ScanCtx*>(ctx);
+	for (size_t i = 0; i < n; ++i)
+		bench_keep(t->head.find_first_of("\r\n"));
+}
+
+static void scan_parse(void *ctx, size_t n) {
+	ScanCtx *t = static_cast<ScanCtx*>(ctx);
+	for (size_t i = 0; i < n; ++i) {
+		t->parser.reset();
+		t->parser.feed(t->head.data(), t->head.size());
+		bench_keep(t->parser.request().headers.size());
+	}
+}
+
+void bench_scan(const BenchArgs &args) {
+	(void)args;
+	static const char *kernels[] = { "scalar", "sse2", "avx2" };
+	static const size_t nKernels = sizeof(kernels) / sizeof(kernels[0]);
+	const char *startKernel = scan_kernel_name();
+
+	// Browser head, and the same head carrying a 4 KB cookie
+	std::string cookie = "Cookie: ";
+	while (cookie.size() < 4096) cookie += "tracking_id_0123456789=abcdefABCDEF0123456789; ";
+	std::string bigHead = BROWSER_GET;
+	bigHead.insert(bigHead.size() - 2, cookie + "\r\n");
+
+	struct Case {
+		const char	*name;
+		std::string	head;
+		void		(*fn)(void*, size_t);
+	};
+	const Case cases[] = {
+		{ "lines, browser head", BROWSER_GET, scan_lines },
+		{ "lines, 4 KB cookie", bigHead, scan_lines },
+		{ "parse, browser head", BROWSER_GET, scan_parse },
+		{ "parse, 4 KB cookie", bigHead, scan_parse },
+		{ "no line end, 64 KB", std::string(65536, 'a'), scan_run },
+	};
+
+	std::printf("ns per op (kernel picked at startup: %s)\n", startKernel);
+	std::printf("%-22s %6s", "workload", "bytes");
+	for (size_t k = 0; k < nKernels; ++k)
+		std::printf(" %10s", kernels[k]);
+	std::printf(" %10s\n", "find()");
+	for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+		ScanCtx t;
+		t.head = cases[c].head;
+		t.parser.setLimits(8192, 8192, 100);
+		std::printf("%-22s %6lu", cases[c].name, (unsigned long)t.head.size());
+		for (size_t k = 0; k < nKernels; ++k) {
+			if (!scan_use_kernel(kernels[k]))
+				std::printf(" %10s", "n/a");
+			else
+				std::printf(" %10.1f", bench_ns_per_op(cases[c].fn, &t));
+		}
+		if (cases[c].fn == scan_lines)
+			std::printf(" %10.1f\n", bench_ns_per_op(scan_lines_find, &t));
+		else if (cases[c].fn == scan_run)
+			std::printf(" %10.1f\n", bench_ns_per_op(scan_run_find, &t));
+		else
+			std::printf(" %10s\n", "-");
+	}
+	scan_use_kernel(startKernel);
+}
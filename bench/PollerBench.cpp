@@ -0,0 +1,208 @@
+#include "Bench.hpp"
+#include "../inc/Poller.hpp"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <stdint.h>
+
+// One loop tick with n registered connections of which one is readable:
+// a non-blocking wait that returns the ready fd. Connections are eventfds
+// so each costs a single descriptor.
+struct TickCtx {
+	Poller						*poller;
+	std::vector<Poller::Event>	out;
+};
+
+static void run_ticks(void *ctx, size_t n) {
+	TickCtx *t = static_cast<TickCtx*>(ctx);
+	for (size_t i = 0; i < n; ++i) {
+		t->out.clear();
+		bench_keep((size_t)t->poller->wait(0, t->out));
+	}
+}
+
+// Reference: the loop before the Poller interface polled the whole pollfd
+// vector, then looked up every connection's entry with a linear search to
+// refresh its interest.
+struct OldTickCtx {
+	std::vector<struct pollfd>	pfds;
+	std::vector<int>			conns;
+};
+
+static void run_old_ticks(void *ctx, size_t n) {
+	OldTickCtx *t = static_cast<OldTickCtx*>(ctx);
+	for (size_t i = 0; i < n; ++i) {
+		bench_keep((size_t)::poll(&t->pfds[0], t->pfds.size(), 0));
+		for (size_t c = 0; c < t->conns.size(); ++c) {
+			for (size_t k = 0; k < t->pfds.size(); ++k) {
+				if (t->pfds[k].fd == t->conns[c]) {
+					t->pfds[k].events = POLLIN;
+					break;
+				}
+			}
+		}
+	}
+}
+
+static double tick_ns(const char *backend, const std::vector<int> &fds) {
+	std::string err;
+	TickCtx t;
+	t.poller = Poller::create(backend, &err);
+	if (std::string(t.poller->name()) != backend) {
+		delete t.poller;
+		return -1;
+	}
+	for (size_t i = 0; i < fds.size(); ++i) t.poller->add(fds[i], POLLIN);
+	double ns = bench_ns_per_op(run_ticks, &t);
+	delete t.poller;
+	return ns;
+}
+
+static double old_tick_ns(const std::vector<int> &fds) {
+	OldTickCtx t;
+	for (size_t i = 0; i < fds.size(); ++i) {
+		struct pollfd p;
+		p.fd = fds[i];
+		p.events = POLLIN;
+		p.revents = 0;
+		t.pfds.push_back(p);
+	}
+	t.conns = fds;
+	return bench_ns_per_op(run_old_ticks, &t);
+}
+
+void bench_poller(const BenchArgs &args) {
+	static const long defaults[] = { 100, 1000, 10000 };
+	std::vector<long> counts = bench_sizes(args, defaults, sizeof(defaults) / sizeof(defaults[0]));
+
+	std::printf("%8s %14s %14s %14s\n", "conns", "poll us/tick", "epoll us/tick", "old us/tick");
+	for (size_t c = 0; c < counts.size(); ++c) {
+		const size_t n = (size_t)counts[c];
+		if (!bench_raise_fd_limit(n)) {
+			std::printf("%8lu  (fd limit too low)\n", (unsigned long)n);
+			continue;
+		}
+		std::vector<int> fds;
+		for (size_t i = 0; i < n; ++i) {
+			int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			if (fd == -1) break;
+			fds.push_back(fd);
+		}
+		if (fds.size() == n) {
+			uint64_t one = 1;
+			bench_keep((size_t)::write(fds[n / 2], &one, sizeof(one)));
+			double p = tick_ns("poll", fds);
+			double e = tick_ns("epoll", fds);
+			double o = old_tick_ns(fds);
+			std::printf("%8lu %14.2f %14.2f %14.2f\n", (unsigned long)n, p / 1000.0, e / 1000.0, o / 1000.0);
+		} else {
+			std::printf("%8lu  (eventfd failed after %lu)\n", (unsigned long)n, (unsigned long)fds.size());
+		}
+		for (size_t i = 0; i < fds.size(); ++i) ::close(fds[i]);
+	}
+}
+
+// Interest bookkeeping per loop iteration with n connections of which k
+// changed state (a response was queued or finished). Before the dirty set
+// the loop recomputed interest and called modify() for every connection;
+// now only dirty ones are re-evaluated and the backend is called on change.
+struct FakeConn {
+	int		fd;
+	bool	writing;
+	bool	dirty;
+	short	applied;
+};
+
+struct InterestCtx {
+	Poller					*poller;
+	std::vector<FakeConn>	conns;
+	std::vector<size_t>		dirty;
+	size_t					active;  // connections that change per iteration
+	size_t					next;
+	bool					all;     // refresh every connection (old loop)
+};
+
+static short interest_of(const FakeConn &c) {
+	return (short)(POLLIN | (c.writing ? POLLOUT : 0));
+}
+
+static void run_interest(void *ctx, size_t n) {
+	InterestCtx *t = static_cast<InterestCtx*>(ctx);
+	for (size_t i = 0; i < n; ++i) {
+		for (size_t a = 0; a < t->active; ++a) {
+			size_t c = (t->next + a * 7919) % t->conns.size();
+			t->conns[c].writing = !t->conns[c].writing;
+			if (!t->conns[c].dirty) {
+				t->conns[c].dirty = true;
+				t->dirty.push_back(c);
+			}
+		}
+		t->next = (t->next + 1) % t->conns.size();
+		if (t->all) {
+			for (size_t c = 0; c < t->conns.size(); ++c) {
+				t->conns[c].dirty = false;
+				t->poller->modify(t->conns[c].fd, interest_of(t->conns[c]));
+			}
+		} else {
+			for (size_t d = 0; d < t->dirty.size(); ++d) {
+				FakeConn &c = t->conns[t->dirty[d]];
+				c.dirty = false;
+				short ev = interest_of(c);
+				if (ev != c.applied && t->poller->modify(c.fd, ev)) c.applied = ev;
+			}
+		}
+		t->dirty.clear();
+	}
+}
+
+static double interest_ns(const char *backend, const std::vector<int> &fds, size_t active, bool all) {
+	std::string err;
+	InterestCtx t;
+	t.poller = Poller::create(backend, &err);
+	for (size_t i = 0; i < fds.size(); ++i) {
+		FakeConn c;
+		c.fd = fds[i];
+		c.writing = false;
+		c.dirty = false;
+		c.applied = POLLIN;
+		t.conns.push_back(c);
+		t.poller->add(fds[i], POLLIN);
+	}
+	t.active = active;
+	t.next = 0;
+	t.all = all;
+	double ns = bench_ns_per_op(run_interest, &t);
+	delete t.poller;
+	return ns;
+}
+
+void bench_interest(const BenchArgs &args) {
+	static const long defaults[] = { 1000, 10000 };
+	static const size_t actives[] = { 1, 10, 100 };
+	std::vector<long> counts = bench_sizes(args, defaults, sizeof(defaults) / sizeof(defaults[0]));
+
+	std::printf("%8s %7s %16s %16s %16s %16s\n", "conns", "active",
+				"poll all us", "poll dirty us", "epoll all us", "epoll dirty us");
+	for (size_t c = 0; c < counts.size(); ++c) {
+		const size_t n = (size_t)counts[c];
+		if (!bench_raise_fd_limit(n)) {
+			std::printf("%8lu  (fd limit too low)\n", (unsigned long)n);
+			continue;
+		}
+		std::vector<int> fds;
+		for (size_t i = 0; i < n; ++i) {
+			int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			if (fd == -1) break;
+			fds.push_back(fd);
+		}
+		for (size_t a = 0; fds.size() == n && a < sizeof(actives) / sizeof(actives[0]); ++a) {
+			if (actives[a] > n) continue;
+			std::printf("%8lu %7lu %16.2f %16.2f %16.2f %16.2f\n", (unsigned long)n, (unsigned long)actives[a],
+						interest_ns("poll", fds, actives[a], true) / 1000.0,
+						interest_ns("poll", fds, actives[a], false) / 1000.0,
+						interest_ns("epoll", fds, actives[a], true) / 1000.0,
+						interest_ns("epoll", fds, actives[a], false) / 1000.0);
+		}
+		for (size_t i = 0; i < fds.size(); ++i) ::close(fds[i]);
+	}
+}
@@ -0,0 +1,204 @@
+#include "Bench.hpp"
+#include "../inc/Router.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+// Reference: the matcher before the radix tree. Locations sorted longest
+// path first, the target copied and normalized on every lookup, then the
+// first prefix that matches wins.
+class LinearRouter {
+public:
+	void build(const std::vector<Location> &locs) {
+		_locs.clear();
+		for (size_t i = 0; i < locs.size(); ++i)
+			_locs.push_back(&locs[i]);
+		std::sort(_locs.begin(), _locs.end(), longer);
+	}
+
+	const Location *match(const std::string &target) const {
+		std::string norm = normalize(target);
+		for (size_t i = 0; i < _locs.size(); ++i) {
+			const std::string &p = _locs[i]->getPath();
+			if (norm.size() >= p.size() && norm.compare(0, p.size(), p) == 0)
+				return _locs[i];
+		}
+		return NULL;
+	}
+
+private:
+	std::vector<const Location*>	_locs;
+
+	static bool longer(const Location *a, const Location *b) {
+		if (a->getPath().size() != b->getPath().size()) return a->getPath().size() > b->getPath().size();
+		return a->getPath() < b->getPath();
+	}
+
+	static std::string normalize(const std::string &t) {
+		if (t.empty()) return std::string("/");
+		std::string out;
+		out.reserve(t.size() + 1);
+		if (t[0] != '/') out.push_back('/');
+		for (size_t i = 0; i < t.size(); ++i)
+			out.push_back(t[i] == '\\' ? '/' : t[i]);
+		return out;
+	}
+};
+
+// Builds a location from its config lines, as ParseConfig does
+static Location make_location(const std::string &decl) {
+	std::vector<std::string> lines;
+	lines.push_back("location " + decl + " {");
+	lines.push_back("}");
+	size_t i = 0;
+	return Location(lines, i);
+}
+
+static std::string num(size_t n) {
+	std::ostringstream oss;
+	oss << n;
+	return oss.str();
+}
+
+// n prefix locations shaped like a real site: a root, a few sections and
+// versioned API resources that share long prefixes
+static void site_locations(size_t n, std::vector<Location> &locs, std::vector<std::string> &targets) {
+	static const char *sections[] = { "/static/", "/images/", "/api/v1/", "/api/v2/", "/docs/", "/users/" };
+	static const size_t nSections = sizeof(sections) / sizeof(sections[0]);
+
+	locs.push_back(make_location("/"));
+	for (size_t i = 1; i < n; ++i) {
+		std::string path = std::string(sections[i % nSections]) + "res" + num(i);
+		locs.push_back(make_location(path));
+		targets.push_back(path + "/item/" + num(i * 7) + "?page=2");
+	}
+	targets.push_back("/favicon.ico");  // falls through to '/'
+	targets.push_back("/api/v3/unknown/resource");
+}
+
+struct RouterCtx {
+	std::vector<Location>		locs;
+	std::vector<std::string>	targets;
+	Router						tree;
+	LinearRouter				linear;
+};
+
+static void route_tree(void *ctx, size_t n) {
+	RouterCtx *t = static_cast<RouterCtx*>(ctx);
+	size_t sum = 0, k = 0;
+	for (size_t i = 0; i < n; ++i) {
+		sum += (size_t)t->tree.match(t->targets[k]);
+		if (++k == t->targets.size()) k = 0;
+	}
+	bench_keep(sum);
+}
+
+static void route_linear(void *ctx, size_t n) {
+	RouterCtx *t = static_cast<RouterCtx*>(ctx);
+	size_t sum = 0, k = 0;
+	for (size_t i = 0; i < n; ++i) {
+		sum += (size_t)t->linear.match(t->targets[k]);
+		if (++k == t->targets.size()) k = 0;
+	}
+	bench_keep(sum);
+}
+
+// Exact locations looked up the naive way: compare the target with each
+// '= path' in config order
+static int linear_exact(const std::vector<Location> &locs, const std::string &target) {
+	for (size_t i = 0; i < locs.size(); ++i)
+		if (locs[i].getMatchType() == Location::MATCH_EXACT && locs[i].getPath() == target)
+			return (int)i;
+	return -1;
+}
+
+struct KindCtx {
+	std::vector<Location>	locs;
+	std::string				target;
+	Router					tree;
+};
+
+static void kind_tree(void *ctx, size_t n) {
+	KindCtx *t = static_cast<KindCtx*>(ctx);
+	size_t sum = 0;
+	for (size_t i = 0; i < n; ++i)
+		sum += (size_t)t->tree.match(t->target);
+	bench_keep(sum);
+}
+
+static void kind_linear_exact(void *ctx, size_t n) {
+	KindCtx *t = static_cast<KindCtx*>(ctx);
+	size_t sum = 0;
+	for (size_t i = 0; i < n; ++i)
+		sum += (size_t)linear_exact(t->locs, t->target);
+	bench_keep(sum);
+}
+
+// Lookups by location type, on top of a 100-location site
+static void bench_router_kinds() {
+	struct Kind {
+		const char	*name;
+		size_t		exact;     // '= /health<i>' locations, plus '= /health'
+		size_t		regex;     // '~ \.ext<i>$' locations
+		bool		priority;  // add '^~ /static/'
+		const char	*target;
+	};
+	static const Kind kinds[] = {
+		{ "= /health, 1 exact", 0, 0, false, "/health" },
+		{ "= /health, 100 exact", 99, 0, false, "/health" },
+		{ "prefix, 10 regex miss", 0, 10, false, "/static/res6/app.css" },
+		{ "regex, 1st of 10", 0, 10, false, "/static/res6/app.ext0" },
+		{ "regex, 10th of 10", 0, 10, false, "/static/res6/app.ext9" },
+		{ "^~ skips 10 regex", 0, 10, true, "/static/app.ext9" },
+	};
+
+	std::printf("\n%-24s %14s %14s\n", "lookup (100 prefixes)", "tree ns", "linear ns");
+	for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); ++k) {
+		KindCtx t;
+		std::vector<std::string> unused;
+		site_locations(100, t.locs, unused);
+		for (size_t i = 0; i < kinds[k].exact; ++i)
+			t.locs.push_back(make_location("= /health" + num(i)));
+		t.locs.push_back(make_location("= /health"));
+		for (size_t i = 0; i < kinds[k].regex; ++i)
+			t.locs.push_back(make_location("~ \\.ext" + num(i) + "$"));
+		if (kinds[k].priority)
+			t.locs.push_back(make_location("^~ /static/"));
+		t.target = kinds[k].target;
+		t.tree.build(t.locs);
+
+		std::printf("%-24s %14.1f", kinds[k].name, bench_ns_per_op(kind_tree, &t));
+		if (kinds[k].regex == 0)
+			std::printf(" %14.1f\n", bench_ns_per_op(kind_linear_exact, &t));
+		else
+			std::printf(" %14s\n", "-");
+	}
+}
+
+void bench_router(const BenchArgs &args) {
+	static const long defaults[] = { 10, 100, 1000 };
+	std::vector<long> counts = bench_sizes(args, defaults, sizeof(defaults) / sizeof(defaults[0]));
+
+	std::printf("%10s %14s %14s %10s\n", "locations", "tree ns", "linear ns", "speedup");
+	for (size_t c = 0; c < counts.size(); ++c) {
+		RouterCtx t;
+		site_locations((size_t)counts[c], t.locs, t.targets);
+		t.tree.build(t.locs);
+		t.linear.build(t.locs);
+
+		// Both must agree before their timings mean anything
+		for (size_t i = 0; i < t.targets.size(); ++i) {
+			int idx = t.tree.match(t.targets[i]);
+			const Location *ref = t.linear.match(t.targets[i]);
+			if ((idx < 0 ? NULL : &t.locs[idx]) != ref) {
+				std::printf("mismatch on %s\n", t.targets[i].c_str());
+				return;
+			}
+		}
+
+		double tree = bench_ns_per_op(route_tree, &t);
+		double linear = bench_ns_per_op(route_linear, &t);
+		std::printf("%10lu %14.1f %14.1f %9.1fx\n", (unsigned long)t.locs.size(), tree, linear, linear / tree);
+	}
+	bench_router_kinds();
+}
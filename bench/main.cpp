@@ -0,0 +1,99 @@
+#include "Bench.hpp"
+#include "../inc/Logger.hpp"
+
+#include <sys/resource.h>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+
+struct BenchEntry {
+	const char	*name;
+	void		(*run)(const BenchArgs &args);
+	const char	*what;
+};
+
+static const BenchEntry BENCHES[] = {
+	{ "poller", bench_poller, "cost of one idle loop tick by connection count, poll vs epoll [counts...]" },
+	{ "interest", bench_interest, "interest bookkeeping per iteration, refresh-all vs dirty set [counts...]" },
+	{ "dispatch", bench_dispatch, "ready fd to handler, std::map lookups vs fd-indexed slots [counts...]" },
+	{ "multipart", bench_multipart, "multipart upload throughput and memory, streaming vs buffered [MB...]" },
+	{ "parser", bench_parser, "request heads parsed per second, state machine vs the old line parser" },
+	{ "scan", bench_scan, "header scanning per kernel (scalar, sse2, avx2) vs std::string::find" },
+	{ "router", bench_router, "location lookup (prefix, exact, regex), radix tree vs linear scans [counts...]" },
+};
+static const size_t BENCH_COUNT = sizeof(BENCHES) / sizeof(BENCHES[0]);
+
+static volatile size_t s_sink;
+
+uint64_t bench_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+double bench_ns_per_op(void (*fn)(void *ctx, size_t n), void *ctx, unsigned minMs) {
+	const uint64_t target = (uint64_t)minMs * 1000000ULL;
+	size_t n = 1;
+	for (;;) {
+		uint64_t t0 = bench_now_ns();
+		fn(ctx, n);
+		uint64_t dt = bench_now_ns() - t0;
+		if (dt >= target) return (double)dt / (double)n;
+		// Aim a little past the target from what this run took
+		size_t next = (dt > 0) ? (size_t)((double)n * (double)target * 1.2 / (double)dt) : n * 100;
+		if (next > n * 100) next = n * 100;
+		n = (next > n) ? next : n * 2;
+	}
+}
+
+std::vector<long> bench_sizes(const BenchArgs &args, const long *defaults, size_t count) {
+	std::vector<long> out;
+	for (size_t i = 0; i < args.size(); ++i) {
+		long v = std::strtol(args[i].c_str(), 0, 10);
+		if (v > 0) out.push_back(v);
+	}
+	if (out.empty()) out.assign(defaults, defaults + count);
+	return out;
+}
+
+void bench_keep(size_t v) {
+	s_sink = s_sink + v;
+}
+
+bool bench_raise_fd_limit(size_t n) {
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) != 0) return false;
+	if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < n + 64) {
+		rl.rlim_cur = (rl.rlim_max == RLIM_INFINITY || rl.rlim_max > n + 64) ? n + 64 : rl.rlim_max;
+		(void)setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	return getrlimit(RLIMIT_NOFILE, &rl) == 0 && (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur >= n + 64);
+}
+
+static void usage() {
+	std::printf("usage: webserv_bench [name [args...]]\n");
+	for (size_t i = 0; i < BENCH_COUNT; ++i) std::printf("  %-10s %s\n", BENCHES[i].name, BENCHES[i].what);
+}
+
+int main(int argc, char **argv) {
+	Logger::setLevel(LOG_ERROR);
+	if (argc > 1 && (std::strcmp(argv[1], "-h") == 0 || std::strcmp(argv[1], "--help") == 0)) {
+		usage();
+		return 0;
+	}
+	if (argc < 2) {
+		for (size_t i = 0; i < BENCH_COUNT; ++i) {
+			std::printf("== %s\n", BENCHES[i].name);
+			BENCHES[i].run(BenchArgs());
+		}
+		return 0;
+	}
+	for (size_t i = 0; i < BENCH_COUNT; ++i) {
+		if (std::strcmp(argv[1], BENCHES[i].name) != 0) continue;
+		BENCHES[i].run(BenchArgs(argv + 2, argv + argc));
+		return 0;
+	}
+	std::fprintf(stderr, "unknown benchmark '%s'\n", argv[1]);
+	usage();
+	return 2;
+}
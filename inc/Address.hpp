@@ -18,6 +18,12 @@ public:
 	// On error, returns an invalid Address (valid()==false) and optionally fills err.
 	static Address fromHostPort(const uint32_t host, const uint16_t port);
 
+	// Local address a socket is bound to (invalid if getsockname fails or not IPv4).
+	static Address ofSocket(int fd);
+
+	// Same IPv4 address and port
+	bool sameAs(const Address &other) const;
+
 	bool valid() const;
 
 	const struct sockaddr *data() const;
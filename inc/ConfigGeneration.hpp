@@ -0,0 +1,44 @@
+#ifndef CONFIGGENERATION_HPP
+#define CONFIGGENERATION_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ServerConfig.hpp"
+
+// One immutable, fully parsed configuration. The event loop holds the current
+// generation and every connection holds the one it was accepted under, so a
+// reload (SIGHUP) never changes the servers an in-flight request sees. The
+// generation is freed when its last holder releases it.
+class ConfigGeneration {
+public:
+	// bindKey -> vhost group (first entry is the default server)
+	typedef std::map<std::string, std::vector<const ServerConfig*> > BindGroups;
+
+	// Starts with one reference, owned by the caller.
+	ConfigGeneration(const std::vector<ServerConfig> &configs, long acceptBudget);
+
+	void	retain();
+	void	release();
+
+	unsigned long		id() const { return _id; }
+	const BindGroups	&binds() const { return _binds; }
+	size_t				serverCount() const { return _configs.size(); }
+	long				acceptBudget() const { return _acceptBudget; }
+
+private:
+	std::vector<ServerConfig>	_configs;
+	BindGroups					_binds;
+	long						_acceptBudget;
+	unsigned long				_id;
+	unsigned long				_refs;
+
+	static unsigned long		s_nextId;
+
+	~ConfigGeneration();
+	ConfigGeneration(const ConfigGeneration &);
+	ConfigGeneration &operator=(const ConfigGeneration &);
+};
+
+#endif
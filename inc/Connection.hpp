@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <deque>
 #include <map>
 #include <stdint.h>
 #include <sys/types.h>
@@ -12,10 +13,13 @@
 #include <cstring>
 #include <iostream>
 #include <cstdio>
+#include <cstdlib>
 #include <sstream>
 #include <algorithm>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
 #include <sys/stat.h>
@@ -23,6 +27,9 @@
 #include <signal.h>
 #include <poll.h>
 #include <cctype>
+#ifdef __linux__
+# include <sys/sendfile.h>
+#endif
 
 #include "EventLoop.hpp"
 #include "Logger.hpp"
@@ -33,6 +40,8 @@
 #include "HttpStatusCodes.hpp"
 #include "LoopUtils.hpp"
 #include "ConnectionUtils.hpp"
+#include "MultipartUpload.hpp"
+#include "Scan.hpp"
 
 class EventLoop;
 
@@ -53,17 +62,39 @@ private:
 	std::string _bindKey;                   // e.g., 127.0.0.1:8080
 	std::string _vhostName;                 // for logging
 
-	// static serving context derived from _srv
-	std::string _root;
-	std::vector<std::string> _index;
-
-	// Router cache for current server
-	Router _router;
-	const ServerConfig* _routerSrv; // last server used to build _router
-
 	HttpParser _parser;
 	std::string _rbuf; // read buffer
-	std::vector<char> _wbuf; // write buffer
+	// Output queue, in request order: memory blocks (heads, generated bodies,
+	// CGI output) gathered into one sendmsg(2), and file regions sent with
+	// sendfile(2). Partial writes advance an offset; nothing is moved.
+	struct OutSegment {
+		std::vector<char> data; // memory block when fd == -1
+		size_t consumed;        // memory bytes of data already sent
+		int    fd;              // file region, owned: closed once sent
+		off_t  offset;
+		size_t length;          // file bytes left
+		bool   buffered;        // sendfile unsupported for this file: pread + send
+	};
+	std::deque<OutSegment> _out;
+	size_t _outMem;  // memory bytes queued, not yet sent
+	bool   _corked;  // TCP_CORK held so a head and its file body share packets
+
+	// Responses fully produced but not yet fully sent (pipelining). Offsets
+	// count bytes over the connection's whole output stream.
+	struct QueuedResponse {
+		uint64_t    start;
+		uint64_t    end;
+		int         status;
+		bool        keepAlive;
+		uint64_t    t_start;
+		std::string reqLine;
+		std::string vhost;
+	};
+	std::deque<QueuedResponse> _outq;
+	uint64_t _queuedTotal; // bytes ever queued
+	uint64_t _sentTotal;   // bytes ever sent
+	uint64_t _respStart;   // stream offset where the current response starts
+	bool     _closing;     // no further request will be read; close once flushed
 
 	// Request lifecycle
 	bool _headersDone;          // headers parsing completed
@@ -75,11 +106,19 @@ private:
 	long _bodyLimit;            // effective client_max_body_size (-1 means unlimited)
 	long _clRemaining;          // bytes remaining for fixed-length mode
 	// Chunked decoding state
-	long _chunkRemaining;       // -1 when expecting size line; >=0 when reading chunk data; 0 means final-chunk seen
+	long _bodyReceived;         // body bytes received so far
+	long _chunkRemaining;       // -1 when expecting size line; >0 when reading chunk data; -2 when expecting the CRLF after it
 	bool _chunkReadingTrailers; // true after 0-chunk, consume trailers until CRLF CRLF
 
 	bool	_drainAfterResponse;
 
+	// Keep-alive
+	bool     _keepAlive;     // connection may carry another request after this response
+	bool     _reqHasBody;    // request announced a body (must be fully read to reuse the connection)
+	bool     _idle;          // between requests, no byte of the next one received yet
+	size_t   _requests;      // requests started on this connection
+	uint64_t _keepaliveMs;   // idle timeout between requests
+
 	bool processChunkedBuffered();
 
 	// timing & stats
@@ -87,9 +126,7 @@ private:
 	uint64_t _t_last_active;
 	uint64_t _t_headers_start;
 	uint64_t _t_write_start;
-	size_t   _bytes_sent;
 	int      _status_code; // 0 until set
-	bool     _logged;
 	std::string _reqLine;
 	std::string _peer;
 
@@ -102,38 +139,86 @@ private:
 	int _cgiPid;
 	int _cgiIn;   // write end to child stdin
 	int _cgiOut;  // read end from child stdout
-	uint64_t _t_cgi_start;
+	uint64_t _t_cgi_active; // start, then last output: the CGI timeout measures silence
 	std::string _cgiHdrBuf;    // header buffer until CRLFCRLF
 	bool _cgiHeadersDone;
 	int _cgiStatusFromCGI;
-	std::map<std::string,std::string> _cgiHdrs;
-	size_t _cgiOutputSent;
-	static const size_t CGI_OUTPUT_MAX = 8 * 1024 * 1024; // safety cap
+	HttpHeaders _cgiHdrs;
+	long _cgiContentLength; // from the CGI headers, -1 when absent
+	size_t _cgiInOff;       // bytes at the front of _bodyBuf already written to the child
+	size_t _cgiOutputSent;  // body bytes received from the child
+	bool   _cgiChunked;     // no Content-Length from the child: relayed with chunked encoding
+	bool   _cgiPaused;      // stdout unregistered while the client is behind
 
 	// For routing across callbacks
 	bool _cgiEnabled;
-	std::string	_locCgiPass;
 	std::string	_locCgiPath;
-	std::string _effRootForRequest;
+	const LocationPlan *_plan;  // matched location (or server default), resolved at config load
+
+	// Uploads stream into temp files in the store, renamed once complete:
+	// a raw body directly, multipart bodies through _multipart
+	MultipartUpload _multipart;
+	int         _uploadFd;
+	std::string _uploadTmp;  // temp path while the body is being received
+	std::string _uploadName; // final file name under the store
 
-	std::string	_matchedLocPath;
-	std::string	_uploadStore;
+	std::string	uploadTargetName() const;
+	bool	beginUpload();  // false once an error response is queued
+	bool	finishUpload(bool &existed); // close and rename into place
+	void	discardUpload();
+	bool	appendBody(const char *data, size_t len); // false once an error response is queued
 
-	bool saveMultipart(const std::string &content_type, std::string &outName, std::string &err, bool &existed);
 	int		uploadAndRespond();
 
 	int		handleFixedBodyChunk(const char *buf, ssize_t n);
 	void	selectVhost(const HttpRequest &req);
 
-	bool	getMethod(const HttpRequest &req, const Location *loc, std::string &effRoot,
-				 		std::vector<std::string> &effIndex, bool isHead, bool effAutoindex);
+	bool	getMethod(const HttpRequest &req, const Location *loc, const LocationPlan &plan, bool isHead);
 	bool	deleteMethod(const std::string &effRoot, const HttpRequest &req);
 	int		postMethod(const HttpRequest &req, const long effectiveLimit);
 
-	void	logAccess();
-
+	QueuedResponse	currentResponse() const;
+	void	logAccess(const QueuedResponse &r);
+
+	// Request lifecycle on a persistent, pipelined connection
+	int		consumeInput(const char *buf, size_t n); // -1 close, 1 response started, 0 need more
+	bool	responseStarted() const { return _status_code != 0 || _cgiState != CGI_NONE; }
+	void	decideKeepAlive(const HttpRequest &req);
+	void	setConnectionHeader(HttpResponse &resp);
+	void	appendOutput(const char *data, size_t len);
+	void	appendOutput(const std::vector<char> &data);
+	void	appendFile(int fd, off_t offset, size_t length); // takes ownership of fd
+	void	appendResponse(const HttpResponse &resp);
+	void	dropOutput(uint64_t len); // take back the last len queued memory bytes
+	void	clearOutput();
+	ssize_t	sendMemorySegments();
+	int		sendFileSegment(OutSegment &seg, size_t &sent);
+	void	setCork(bool on);
+	bool	pipelineFull() const;
+	bool	advance();          // queue finished responses, parse requests already read
+	bool	completeResponse(); // move the current response to _outq, reset for the next request
+	bool	retireSent();       // log and drop fully sent responses; false once closed
+	void	resetRequest();
+
+	// Timer bookkeeping: record response start and (re)arm the loop's deadline
+	void	markWriteStart();
+	void	armTimer();
+	void	interestChanged(); // ask the loop to re-evaluate wantRead/wantWrite
+
+	bool	cgiEvent(int fd, short revents);
+	void	feedCgiInput();
+	// Fixed-length body still arriving for a CGI already running
+	bool	cgiAwaitingBody() const { return _cgiState == CGI_STREAMING && _bodyState == BODY_FIXED && _clRemaining > 0; }
+	bool	cgiClockRunning() const;
+	void	appendCgiBody(const char *data, size_t len);
+	void	pauseCgiOutput(bool pause);
 	bool	startCgiCurrent();
 	void	closeCgiPipes();
+	void	releaseCgiChild(); // reap the child now or leave it to the loop
+	// Kill the child (if any), close pipes, mark CGI done. Returns false when part
+	// of the CGI response already reached the client (no error response possible).
+	bool	abortCgi();
+	bool	failCgi(const HttpStatusCode::e &status); // abort, then error response or close
 
 	void closeFd();
 	std::string getMimeType(const std::string &path);
@@ -142,10 +227,10 @@ private:
 	void	returnHttpResponse(const HttpStatusCode::e &status_code);
 	void	returnHttpResponse(const HttpStatusCode::e &status_code, const std::string &allow);
 	void returnHttpResponse(const ReturnDir &dir);
-	void returnCreatedResponse(const std::string &location, const size_t sizeBytes);
+	void returnCreatedResponse(const std::string &location, const std::string &summary);
 	void returnOKResponse(std::string body, std::string content_type);
 
-	bool	handle(const std::string &root, const std::vector<std::string> &indexList, const HttpRequest &req, bool isHead,
+	bool	handle(const std::string &root, const std::vector<std::string> &indexList, const std::string &target, bool isHead,
 				   bool autoindex, HttpResponse &outResp, const Location *loc, std::string &err);
 
 	bool	startCgiWith(const std::string &cgiPass, const std::string &cgiPath,
@@ -169,10 +254,14 @@ public:
 	// Auxiliary (CGI) fds readiness; return false to close client
 	bool	onAuxEvent(int fd, short revents);
 
-	// Timeout sweep hook; returns true to keep, false to remove/close
+	// Timeout hook, called when the armed deadline passes; returns true to keep, false to remove/close
 	bool	checkTimeouts(uint64_t now_ms);
+	// Earliest pending deadline (idle, write drain or CGI), 0 if none
+	uint64_t	nextDeadline() const;
 
 	bool	isClosed() const { return _closed; }
+	// Waiting for the next request on a kept-alive connection, nothing to send
+	bool	isIdle() const { return !_closed && _idle && _out.empty(); }
 };
 
 
@@ -12,8 +12,13 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
 #include <sstream>
 
+#include "HttpHeaders.hpp"
+
 struct DirCmp {
 	std::string	fsPath;
 	DirCmp(const std::string &p) : fsPath(p) {}
@@ -31,10 +36,13 @@ bool		generate_autoindex_tree(const std::string &fsPath, const std::string &urlP
 std::string	getFilefromExt(const std::string &target, const std::string &root, const std::string &ext);
 std::string	peer_of(int fd);
 std::string	normalize_target_simple(const std::string &t);
+size_t		prefix_end(const std::string &target, const std::string &prefix);
+std::string	location_suffix(const std::string &target, const std::string &prefix);
 std::string	base_name_only(const std::string &p);
 std::string	gen_unique_upload_name();
 std::string	safe_filename(const std::string &s);
+int			open_upload_temp(const std::string &dir, std::string &path);
 std::string join_path_relative(const std::string &a, const std::string &b);
-std::string find_header_icase(const std::map<std::string, std::string> &hdrs, const std::string &name);
+bool		content_lengths_agree(const HttpHeaders &hdrs);
 std::string strip_port(const std::string &host);
 std::string to_lower_copy(const std::string &s);
@@ -0,0 +1,39 @@
+#ifndef EPOLLPOLLER_HPP
+#define EPOLLPOLLER_HPP
+
+#include <vector>
+
+#include "Poller.hpp"
+
+#ifdef __linux__
+# include <sys/epoll.h>
+
+// Linux epoll(7) backend (level-triggered). The last interest set per fd is
+// cached so epoll_ctl(MOD) is only issued when the interest actually changes.
+class EpollPoller : public Poller {
+public:
+	EpollPoller();
+	virtual ~EpollPoller();
+
+	// Returns false if epoll_create1 failed (caller should fall back).
+	bool	open(std::string *err);
+
+	virtual const char	*name() const;
+	virtual bool	add(int fd, short events);
+	virtual bool	modify(int fd, short events);
+	virtual void	remove(int fd);
+	virtual int		wait(int timeoutMs, std::vector<Event> &out);
+
+private:
+	int								_epfd;
+	size_t							_count;    // registered fds
+	std::vector<short>				_interest; // fd -> last interest, -1 when absent
+	std::vector<struct epoll_event>	_events;   // wait() scratch buffer
+
+	EpollPoller(const EpollPoller &);
+	EpollPoller &operator=(const EpollPoller &);
+};
+
+#endif
+
+#endif
@@ -18,15 +18,45 @@
 #include "Logger.hpp"
 #include "ServerConfig.hpp"
 #include "LoopUtils.hpp"
+#include "Poller.hpp"
+#include "TimerQueue.hpp"
+#include "ConfigGeneration.hpp"
+#include "Listener.hpp"
 
 class Connection;
 
-// Single-threaded poll() loop with graceful shutdown and timeouts
+// Single-threaded readiness loop (epoll or poll backend) with graceful shutdown and timeouts
 class EventLoop {
 public:
-	EventLoop();
+	// backend: "auto" (epoll when available), "epoll" or "poll"
+	explicit EventLoop(const std::string &backend = "auto");
 	~EventLoop();
 
+	const char *backendName() const { return _poller->name(); }
+
+	// Max connections accepted per listener wakeup, so a connection storm
+	// cannot starve established clients (the rest is picked up next tick).
+	static const size_t DEFAULT_ACCEPT_BUDGET = 64;
+	void setAcceptBudget(size_t n) { _acceptBudget = n ? n : DEFAULT_ACCEPT_BUDGET; }
+
+	// SIGUSR2 re-executes the binary with our listeners (single-process mode only;
+	// in worker mode the master handles upgrades).
+	void setUpgradeEnabled(bool on) { _upgradeEnabled = on; }
+
+	// New listeners bind with SO_REUSEPORT (one listener set per worker)
+	void setReusePort(bool on) { _reusePort = on; }
+
+	// Make gen the current configuration: open listeners for new bind keys
+	// (adopting a matching fd from inherited when given), close those no longer
+	// configured and switch the others to the new vhost groups. Connections keep
+	// the generation they were accepted under. Takes over the caller's reference
+	// on success; on failure nothing changes and the caller keeps it.
+	bool applyConfig(ConfigGeneration *gen, std::vector<int> *inherited, std::string *err);
+
+	// SIGHUP builds a new generation through loader and applies it.
+	typedef ConfigGeneration *(*ConfigLoader)(void *ctx, std::string *err);
+	void setConfigLoader(ConfigLoader fn, void *ctx) { _loader = fn; _loaderCtx = ctx; }
+
 	// Register a listening socket fd for a bind key and its vhost group.
 	// Returns false on invalid fd or duplicate registration.
 	bool addListen(int fd,
@@ -41,31 +71,102 @@ public:
 	// Request the loop to stop.
 	void stop();
 
+	// Draining after a stop signal: connections must not be kept alive
+	bool shuttingDown() const { return _shuttingDown; }
+
 	// Auxiliary file descriptors (e.g., CGI pipes)
 	bool registerAuxFd(int fd, Connection* owner, short events);
 	void updateAuxFd(int fd, short events);
 	void unregisterAuxFd(int fd);
 
+	// Schedule a timeout check for a client fd at deadline (ms, now_ms() clock).
+	// Only pulls the pending check earlier; later deadlines are picked up lazily.
+	void armTimer(int fd, uint64_t deadline);
+
+	// A connection's wantRead()/wantWrite() may have changed outside its own
+	// readiness callback (CGI output, timeout response...). Interest for dirty
+	// fds is re-evaluated once at the end of the current iteration.
+	void markDirty(int fd);
+
+	// Reap a child process (CGI) that may not have exited yet: on SIGCHLD
+	// if waitpid cannot collect it now
+	void adoptChild(pid_t pid);
+
+	// Poll interest changes actually applied (total, and over the last second)
+	unsigned long interestUpdates() const { return _interestUpdates; }
+	unsigned long interestUpdatesPerSec() const { return _updateRate; }
+
 private:
 	int _sigFd;             // self-pipe read end
+	int _reserveFd;         // spare fd released to shed connections on EMFILE
+	size_t _acceptBudget;
 	bool _running;
 	bool _shuttingDown;
-	std::vector<struct pollfd> _pfds;
-	std::map<int, Connection*> _conns; // client fd -> connection
+	bool _upgradeEnabled;
+	pid_t _upgradePid;      // new instance started by SIGUSR2, until it takes over
+	bool _reusePort;
+	ConfigGeneration *_gen; // current configuration (new accepts use it)
+	ConfigLoader _loader;
+	void *_loaderCtx;
+	Poller *_poller;
+	std::vector<Poller::Event> _ready; // reused per tick
+	TimerQueue _timers;                // client fd -> next timeout check
+	std::vector<int> _expired;         // reused per tick
+	std::vector<int> _dirty;           // client fds to re-evaluate this iteration
+	std::vector<pid_t> _children;      // adopted children still running
 
-	// Multi-listener support
-	std::map<int, std::string> _listenKeys; // listen fd -> bindKey
-	std::map<int, std::vector<const ServerConfig*> > _listenGroups; // listen fd -> vhost group
+	unsigned long _interestUpdates;
+	unsigned long _statUpdates;
+	uint64_t _statWindowStart;
+	uint64_t _statLastLog;
+	unsigned long _updateRate;
 
-	// Auxiliary fds mapped to owning connections
-	std::map<int, Connection*> _auxConns;
+	// Every fd the loop watches has a slot in a table indexed by the fd itself,
+	// so dispatching a ready fd is a single array access.
+	enum SlotKind { SLOT_FREE = 0, SLOT_SIGNAL, SLOT_LISTEN, SLOT_CLIENT, SLOT_AUX };
+	struct Slot {
+		unsigned char kind;
+		unsigned char dirty;    // client: already queued in _dirty
+		short interest;         // client: events last applied to the poller
+		int listen;             // listen: index in _listens
+		Connection *conn;       // client: the connection; aux: its owner
+		ConfigGeneration *gen;  // client: generation it was accepted under
+	};
+	struct Listen {
+		int fd;
+		std::string bindKey;
+		std::vector<const ServerConfig*> group; // vhost group
+		Listener *owner;        // set when the loop opened the socket itself
+	};
+	std::vector<Slot> _slots;
+	std::vector<Listen> _listens;
+	size_t _clients;            // live SLOT_CLIENT entries
 
 	void handleListenReadable(int lfd, short revents);
+	size_t acceptPending(int lfd, size_t budget);
+	int acceptClient(int lfd);
+	bool shedConnection(int lfd);
 	void handleSignalReadable(short revents);
+	void startUpgrade();
+	void reapUpgrade();
+	void reapChildren();
+	void reload();
+	int findListen(const std::string &bindKey) const;
+	bool openListener(Listener *lst, const ServerConfig &sc, std::vector<int> *inherited, std::string *err);
+	void removeListen(size_t idx);
 	void addClient(int cfd, int listenFd);
 	void removeClient(int cfd);
 	void disableAllListensInPoll();
-	void sweepTimeouts(uint64_t now_ms);
+	void closeIdleClients();
+	void expireTimers(uint64_t now_ms);
+	void updateInterest(int cfd, Connection *c);
+	void flushDirty();
+	void updateStats(uint64_t now);
+	Slot &slotFor(int fd);
+	Slot *slotAt(int fd, int kind);
+
+	EventLoop(const EventLoop &);
+	EventLoop &operator=(const EventLoop &);
 };
 
 #endif
@@ -0,0 +1,41 @@
+#ifndef HANDOFF_HPP
+#define HANDOFF_HPP
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// Zero-downtime binary upgrade (SIGUSR2). The running instance re-executes
+// argv[0] with its listening fds left open and listed in WEBSERV_LISTEN_FDS;
+// the new instance adopts them instead of binding, then signals the old one
+// (WEBSERV_UPGRADE_FROM) to stop accepting and drain its connections.
+// Pre-bound sockets from a supervisor (systemd-style LISTEN_FDS/LISTEN_PID or
+// --inherit-fd) are adopted the same way, matched to servers by local address.
+class Handoff {
+public:
+	// Remember the command line used to re-execute ourselves.
+	static void setArgv(char **argv);
+
+	// Listening fds handed over by a previous instance or by a supervisor
+	// through LISTEN_FDS (starting at fd 3, only if LISTEN_PID is ours).
+	// Consumes the variables so CGI children do not see them.
+	static std::vector<int> inheritedFds();
+
+	// Parse a comma-separated fd list (e.g. "--inherit-fd 3,4") and append the
+	// open ones to out. Returns false with err set on a malformed or closed fd.
+	static bool parseFdList(const std::string &list, std::vector<int> &out, std::string *err);
+
+	// Pid of the instance being replaced, 0 if none (consumes the variable).
+	static pid_t upgradedFrom();
+
+	// Start a new instance that inherits fds. Returns its pid, or -1 with err set.
+	static pid_t spawn(const std::vector<int> &fds, std::string *err);
+
+	// New instance is serving: ask the old one to drain and exit.
+	static void notifyReady(pid_t old);
+
+private:
+	static char **s_argv;
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef HTTP_HEADERS_HPP
+#define HTTP_HEADERS_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Header fields in arrival order, duplicates kept. Names are matched
+// case-insensitively: well-known names resolve to a Known slot when they
+// are added, so looking them up is an array index; other names go through
+// a small hash table keyed on the lowercased name. Repeated fields are
+// chained so all values of a name can be walked or joined.
+class HttpHeaders {
+public:
+	enum Known {
+		H_OTHER = -1,
+		H_HOST = 0,
+		H_CONNECTION,
+		H_CONTENT_LENGTH,
+		H_CONTENT_TYPE,
+		H_TRANSFER_ENCODING,
+		H_EXPECT,
+		H_KEEP_ALIVE,
+		H_UPGRADE,
+		H_ACCEPT,
+		H_ACCEPT_ENCODING,
+		H_ACCEPT_LANGUAGE,
+		H_AUTHORIZATION,
+		H_COOKIE,
+		H_IF_MODIFIED_SINCE,
+		H_IF_NONE_MATCH,
+		H_RANGE,
+		H_REFERER,
+		H_USER_AGENT,
+		H_KNOWN_COUNT
+	};
+
+	static const size_t npos = (size_t)-1;
+
+	struct Field {
+		std::string name;   // as sent
+		std::string value;
+		Known       known;
+		uint32_t    hash;   // of the lowercased name
+		size_t      next;   // next field with the same name, npos at the end
+		bool        repeat; // an earlier field has the same name
+	};
+
+	HttpHeaders();
+
+	void	clear();
+	void	add(const char *name, size_t nameLen, const char *value, size_t valueLen);
+	void	add(const std::string &name, const std::string &value);
+
+	// First field of a name, npos when absent
+	size_t	find(Known k) const;
+	size_t	find(const std::string &name) const;
+	// First value of a name, empty when absent
+	std::string	get(Known k) const;
+	std::string	get(const std::string &name) const;
+	size_t	count(Known k) const;
+	// All values of the field's name, comma-joined (RFC 9110 5.3)
+	std::string	joined(size_t i) const;
+
+	size_t	size() const { return _fields.size(); }
+	bool	empty() const { return _fields.empty(); }
+	const Field	&at(size_t i) const { return _fields[i]; }
+
+	static Known	lookup(const char *name, size_t len);
+
+private:
+	std::vector<Field>	_fields;
+	size_t				_known[H_KNOWN_COUNT]; // first field per known name
+	std::vector<size_t>	_slots;   // other names: first field + 1, 0 when empty
+	size_t				_others;  // distinct other names in _slots
+
+	size_t	findOther(const char *name, size_t len, uint32_t hash) const;
+	void	link(size_t first, size_t i);
+	void	rehash(size_t capacity);
+};
+
+#endif
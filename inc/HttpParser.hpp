@@ -2,18 +2,50 @@
 #define HTTP_PARSER_HPP
 
 #include <string>
+#include <vector>
 #include <map>
 #include <cctype>
 #include <sstream>
 #include <iostream>
 
+#include "HttpHeaders.hpp"
+
+// Request methods. The value doubles as the bit index in a Location's
+// allowed-method mask.
+enum HttpMethod {
+	METHOD_OTHER = 0,  // extension method; only the string is known
+	METHOD_GET,
+	METHOD_HEAD,
+	METHOD_POST,
+	METHOD_PUT,
+	METHOD_DELETE,
+	METHOD_CONNECT,
+	METHOD_OPTIONS,
+	METHOD_TRACE,
+	METHOD_PATCH,
+	METHOD_COUNT
+};
+
+// Methods are case-sensitive (RFC 9110 9.1)
+HttpMethod	parse_method(const char *p, size_t n);
+inline HttpMethod	parse_method(const std::string &s) { return parse_method(s.data(), s.size()); }
+
 struct HttpRequest {
+	HttpRequest() : methodId(METHOD_OTHER) {}
+
 	std::string method;
+	HttpMethod methodId;
 	std::string target; // request-target (path or absolute-form)
 	std::string version; // e.g., HTTP/1.1
-	std::map<std::string, std::string> headers;
+	HttpHeaders headers;
 };
 
+// Resumable request-head parser. Bytes are appended to one buffer and
+// scanned exactly once by a per-byte state machine that survives across
+// feed() calls; runs of target, header-name and header-value bytes are
+// skipped with the vector scanners from Scan.hpp. The request line and
+// headers are recorded as offset/length slices of that buffer and only
+// turned into strings when request() is first asked for.
 class HttpParser {
 public:
 	enum Result { NEED_MORE = 0, OK = 1, ERROR = 2 };
@@ -36,34 +68,78 @@ public:
 	// Configure limits (bytes/lines) before feeding data
 	void setLimits(size_t maxStartLine, size_t maxHeaderLine, size_t maxHeaders);
 
+	// Forget the current request (limits are kept) to parse the next one on
+	// the same connection. Take any remaining bytes first.
+	void reset();
+
 	// Feed new data chunk; returns parser state.
 	Result feed(const char *data, size_t len);
 
 	// If OK: access parsed request. If ERROR: access error message and kind.
-	const HttpRequest &request() const { return _req; }
+	const HttpRequest &request() const;
 	const std::string &error() const { return _err; }
 	ErrorKind errorKind() const { return _errKind; }
 
 	// After headers are parsed (OK), any extra bytes already read are kept here.
 	// Use these helpers to access/consume them when starting to read the body.
-	size_t remainingSize() const { return _buf.size(); }
-	void takeRemaining(std::string &out) { out.swap(_buf); }
+	size_t remainingSize() const { return _buf.size() - _pos; }
+	void takeRemaining(std::string &out);
 
 private:
+	enum State {
+		S_START = 0,  // optional empty lines before the request line
+		S_METHOD,
+		S_SP1,
+		S_TARGET,
+		S_SP2,
+		S_VERSION,
+		S_RL_TAIL,    // whitespace after the version
+		S_RL_LF,
+		S_HDR_START,
+		S_NAME,
+		S_VALUE_LWS,
+		S_VALUE,
+		S_HDR_LF,
+		S_END_LF,
+		S_DONE,
+		S_ERROR
+	};
+
+	struct Slice {
+		size_t off;
+		size_t len;
+	};
+	struct HeaderSlice {
+		Slice name;
+		Slice value;
+	};
+
 	std::string _buf;
-	HttpRequest _req;
+	size_t _pos;        // next byte to scan
+	State _state;
+	size_t _lineStart;  // offset where the current line began
+	size_t _lineMax;    // limit for the current line
+	size_t _valueEnd;   // end of the header value, trailing blanks excluded
+
+	Slice _method;
+	Slice _target;
+	Slice _version;
+	HeaderSlice _hdr;   // header being scanned
+	std::vector<HeaderSlice> _headers;
+
+	mutable HttpRequest _req;  // materialized from the slices on demand
+	mutable bool _built;
 	std::string _err;
 	ErrorKind _errKind;
-	bool _haveStartLine;
-	bool _done;
 
 	// Limits
 	size_t _maxStartLine;
 	size_t _maxHeaderLine;
 	size_t _maxHeaders;
 
-	bool parseStartLine();
-	bool parseHeaders();
+	Result fail(ErrorKind kind, const char *msg);
+	size_t scanLimit(size_t n) const;
+	bool versionIs(const char *v) const;
 };
 
 #endif // HTTP_PARSER_HPP
@@ -7,6 +7,7 @@
 #include <sstream>
 #include <ctime>
 #include <cstdio>
+#include <sys/types.h>
 #include "HttpStatusCodes.hpp"
 
 class HttpResponse {
@@ -14,6 +15,10 @@ private:
 	HttpStatusCode::e					_status_code;
 	std::map<std::string, std::string>	_headers;
 	std::string							_body;
+	int									_fileFd;     // body sent from a file when != -1
+	off_t								_fileOffset;
+	size_t								_fileLength;
+	bool								_closeDelimited; // no framing header: body ends with the connection
 
 	std::string	dateNow() const;
 public:
@@ -23,6 +28,16 @@ public:
 	void	setStatus(HttpStatusCode::e status_code);
 	void	setHeader(const std::string &name, const std::string &value);
 	void	setBody(const std::string &body);
+	// Body is length bytes of fd from offset, sent by the connection without
+	// copying; serialize() then only produces the head. fd is not owned.
+	void	setFileBody(int fd, off_t offset, size_t length);
+	// Body of unknown length streamed after the head and ended by closing
+	// the connection: no Content-Length is added.
+	void	setCloseDelimited();
+
+	int		fileFd() const { return _fileFd; }
+	off_t	fileOffset() const { return _fileOffset; }
+	size_t	fileLength() const { return _fileLength; }
 
 	// Serialize to a byte vector.
 	std::vector<char>	serialize() const;
@@ -12,7 +12,11 @@ public:
 	Listener();
 	~Listener() throw();
 
-	bool start(const ServerConfig &cfg, std::string *err);
+	// reusePort: set SO_REUSEPORT so several workers can bind the same address
+	bool start(const ServerConfig &cfg, std::string *err, bool reusePort = false);
+	// Take over an already listening socket bound to cfg's address (no bind).
+	// Fails without taking ownership when fd is not listening on that address.
+	bool adopt(int fd, const ServerConfig &cfg, std::string *err);
 	void stop() throw();
 
 	bool isListening() const;
@@ -5,6 +5,7 @@
 #include "HttpStatusCodes.hpp"
 #include "ParseUtils.hpp"
 #include "InvalidFormat.hpp"
+#include "HttpParser.hpp"
 
 struct ReturnDir {
 	int							code;
@@ -12,8 +13,35 @@ struct ReturnDir {
 	ReturnDir() : code(0) {}
 };
 
+// What a request needs from its location, resolved once when the config is
+// loaded: server-level defaults are filled in and paths joined to the root.
+struct LocationPlan {
+	std::string					path;         // prefix to strip from targets, ending in '/'; empty for the server default and for exact/regex locations
+	std::string					root;
+	std::vector<std::string>	index;
+	bool						autoindex;
+	long						bodyLimit;    // -1 for no limit
+	bool						cgi;
+	std::string					cgiPass;
+	std::string					cgiPath;      // under root; empty when picked by cgi_ext
+	std::string					cgiExt;
+	std::string					uploadStore;  // under root
+	bool						cgiByTarget;  // regex location without cgi_path: the target names the script
+	LocationPlan() : autoindex(false), bodyLimit(-1), cgi(false), cgiByTarget(false) {}
+};
+
 class Location {
+public:
+	enum MatchType {
+		MATCH_PREFIX = 0,       /**< 'location /path': longest prefix. */
+		MATCH_PREFIX_PRIORITY,  /**< 'location ^~ /path': longest prefix, regexes are skipped. */
+		MATCH_EXACT,            /**< 'location = /path': whole path only. */
+		MATCH_REGEX,            /**< 'location ~ re': POSIX extended regex. */
+		MATCH_REGEX_ICASE       /**< 'location ~* re': case-insensitive regex. */
+	};
+
 private:
+	MatchType					match_type;
 	std::string					path;
 	std::string					root;
 	std::string					cgi_pass;
@@ -21,10 +49,13 @@ private:
 	std::string					cgi_ext;
 	std::vector<std::string>	index;
 	std::vector<std::string>	allowed_methods;
+	unsigned					allowed_mask;  // 1 << HttpMethod per listed method
+	std::string					allow_header;  // 405 Allow value, built with the mask
 	ReturnDir					return_dir;
 	std::string					upload_store;
 	bool						autoindex;
 	long long					client_max_body_size;
+	LocationPlan				plan;
 
 	void	swap(Location &other);
 	enum DirectiveType {
@@ -51,6 +82,7 @@ private:
 	void	parseClientSize(std::istringstream &iss);
 	void	parseReturn(std::istringstream &iss, const std::string var, const std::string line);
 	void	parseCgiExt(std::istringstream &iss);
+	void	buildAllowHeader();
 
 public:
 	Location();
@@ -59,19 +91,27 @@ public:
 	~Location();
 	Location(std::vector<std::string> &conf_vec, size_t &i);
 	bool	hasReturnDir() const;
-	std::string	getPath() const;
-	std::string	getRoot() const;
-	std::string	getCgiPass() const;
-	std::string	getCgiPath() const;
-	std::string	getCgiExt() const;
-	std::vector<std::string>	getIndex() const;
-	std::vector<std::string>	getAllowedMethods() const;
-	std::string					getMethod(const std::string method) const;
-	std::string::size_type		findMethod(const std::string &method) const;
+	MatchType	getMatchType() const;
+	bool	isRegex() const;
+	const std::string	&getPath() const;
+	const std::string	&getRoot() const;
+	const std::string	&getCgiPass() const;
+	const std::string	&getCgiPath() const;
+	const std::string	&getCgiExt() const;
+	const std::vector<std::string>	&getIndex() const;
+	const std::vector<std::string>	&getAllowedMethods() const;
+	bool	allowsMethod(HttpMethod method) const;  // true for any method without allowed_methods
+	bool	listsMethod(HttpMethod method) const;   // named in allowed_methods
+	const std::string	&getAllowHeader() const;
 	ReturnDir	getReturnDir() const;
-	std::string	getUploadStore() const;
+	const std::string	&getUploadStore() const;
 	long long	getClientMaxBodySize() const;
 	bool	getAutoindex() const;
+
+	// Resolve the plan against the enclosing server; called once the server
+	// block is complete.
+	void	freeze(const std::string &srvRoot, const std::vector<std::string> &srvIndex, long long srvBodyLimit);
+	const LocationPlan	&getPlan() const;
 };
 
 
@@ -0,0 +1,61 @@
+#ifndef MULTIPART_UPLOAD_HPP
+#define MULTIPART_UPLOAD_HPP
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// Streaming multipart/form-data receiver for upload_store locations. Body
+// bytes are fed as they come off the socket; each file part is written to
+// a temp file in the store while it arrives, and all of them are renamed
+// into place by finish(). Only a delimiter-length window (plus the part
+// headers) is held in memory. Parts without a filename are skipped.
+class MultipartUpload {
+public:
+	struct File {
+		std::string name;    // sanitized file name in the store
+		size_t      size;
+		bool        existed; // replaced a file of the same name
+	};
+
+	MultipartUpload();
+	~MultipartUpload();
+
+	// Start a body for the given Content-Type. Returns false with err set
+	// when it carries no usable boundary.
+	bool	begin(const std::string &store, const std::string &contentType, std::string *err);
+	bool	active() const { return _state != IDLE; }
+
+	// Feed body bytes. Returns false with err set on a malformed body
+	// (badRequest true) or a write failure; the upload is then discarded.
+	bool	feed(const char *data, size_t len, std::string *err, bool *badRequest);
+
+	// Body complete: requires the closing delimiter and at least one file
+	// part, then renames the files into place.
+	bool	finish(std::string *err, bool *badRequest);
+
+	// Drop temp files and reset (also done by the destructor).
+	void	abort();
+
+	const std::vector<File>	&files() const { return _files; }
+
+private:
+	enum State { IDLE = 0, PREAMBLE, DELIMITER, HEADERS, BODY, DONE };
+
+	State		_state;
+	std::string	_store;
+	std::string	_delim;   // CRLF "--" boundary
+	std::string	_window;  // bytes not yet consumed (a partial delimiter or header block)
+	int			_fd;      // current file part, -1 when skipping the part
+	std::vector<std::string>	_tmp; // temp path per entry of _files
+	std::vector<File>			_files;
+
+	bool	startPart(const std::string &headers, std::string *err);
+	bool	writePart(const char *data, size_t len, std::string *err);
+	bool	endPart(std::string *err);
+
+	MultipartUpload(const MultipartUpload &);
+	MultipartUpload &operator=(const MultipartUpload &);
+};
+
+#endif
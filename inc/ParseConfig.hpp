@@ -21,6 +21,12 @@ private:
 	/** @brief The parsed server configuration. */
 	std::vector<ServerConfig>    configs;
 
+	/** @brief Number of worker processes from the top-level 'workers' directive (0 when unset). */
+	long	workers;
+
+	/** @brief Max connections accepted per listener wakeup, from 'accept_budget' (0 when unset). */
+	long	acceptBudget;
+
 	/**
 	 * @brief Swaps the contents of this ParseConfig with another.
 	 * @param other The ParseConfig to swap with.
@@ -34,6 +40,29 @@ private:
 	 */
 	static void parseHeader(std::vector<std::string> &conf_vec, size_t &i);
 
+	/**
+	 * @brief Parses a top-level directive (outside any server block), e.g. "workers 4;".
+	 * @param conf_vec The configuration lines.
+	 * @param i The current line; advanced past blank lines, comments and consumed directives.
+	 * @return false when the current line starts a server block (or is not a global directive).
+	 * @throws InvalidFormat if the directive is invalid.
+	 */
+	bool parseGlobalDirective(std::vector<std::string> &conf_vec, size_t &i);
+
+	/**
+	 * @brief Handles the top-level 'workers' directive ("auto" or a positive count).
+	 * @param iss The input string stream containing the value.
+	 * @throws InvalidFormat if the value is invalid.
+	 */
+	void handleWorkers(std::istringstream &iss);
+
+	/**
+	 * @brief Handles the top-level 'accept_budget' directive (a positive count).
+	 * @param iss The input string stream containing the value.
+	 * @throws InvalidFormat if the value is invalid.
+	 */
+	void handleAcceptBudget(std::istringstream &iss);
+
 	/**
 	 * @brief Parses the main configuration block.
 	 * @param fileStream The input file stream.
@@ -95,6 +124,20 @@ private:
 	void	handleRequestSize(std::istringstream &iss, ServerConfig &config);
 	void	handleServerName(std::string var, std::string args, ServerConfig &config);
 
+	/**
+	 * @brief Handles the 'keepalive_timeout' directive (seconds, or "<n>ms"; 0 disables keep-alive).
+	 * @param iss The input string stream containing the value.
+	 * @throws InvalidFormat if the value is invalid.
+	 */
+	void	handleKeepaliveTimeout(std::istringstream &iss, ServerConfig &config);
+
+	/**
+	 * @brief Handles the 'keepalive_requests' directive (max requests per connection; 0 disables keep-alive).
+	 * @param iss The input string stream containing the count.
+	 * @throws InvalidFormat if the value is invalid.
+	 */
+	void	handleKeepaliveRequests(std::istringstream &iss, ServerConfig &config);
+
 	void handleHost(std::istringstream &iss, ServerConfig &config);
 
 	void	checkBrackets(const std::vector<std::string> conf_vec);
@@ -137,6 +180,18 @@ public:
 	 */
 	std::vector<ServerConfig>	getConfigs() const;
 
+	/**
+	 * @brief Gets the worker process count requested by the configuration.
+	 * @return The count, or 0 when the 'workers' directive is absent.
+	 */
+	long	getWorkers() const;
+
+	/**
+	 * @brief Gets the per-wakeup accept budget requested by the configuration.
+	 * @return The budget, or 0 when the 'accept_budget' directive is absent.
+	 */
+	long	getAcceptBudget() const;
+
 	/**
 	 * @class CouldNotOpenFile
 	 * @brief Exception thrown when a configuration file cannot be opened.
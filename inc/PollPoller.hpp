@@ -0,0 +1,29 @@
+#ifndef POLLPOLLER_HPP
+#define POLLPOLLER_HPP
+
+#include <vector>
+#include <poll.h>
+
+#include "Poller.hpp"
+
+// Portable poll(2) backend. Keeps an fd -> slot index so add/modify/remove
+// are O(1) (removal swaps the last pollfd into the freed slot).
+class PollPoller : public Poller {
+public:
+	PollPoller();
+	virtual ~PollPoller();
+
+	virtual const char	*name() const;
+	virtual bool	add(int fd, short events);
+	virtual bool	modify(int fd, short events);
+	virtual void	remove(int fd);
+	virtual int		wait(int timeoutMs, std::vector<Event> &out);
+
+private:
+	std::vector<struct pollfd>	_pfds;
+	std::vector<int>			_index; // fd -> position in _pfds, -1 when absent
+
+	int	indexOf(int fd) const;
+};
+
+#endif
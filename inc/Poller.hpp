@@ -0,0 +1,38 @@
+#ifndef POLLER_HPP
+#define POLLER_HPP
+
+#include <string>
+#include <vector>
+#include <poll.h>
+
+// Readiness backend used by EventLoop. Interest and readiness are expressed
+// with poll(2) bits (POLLIN, POLLOUT, POLLERR, POLLHUP, POLLNVAL) whatever
+// the underlying mechanism is, so Connection handlers stay backend-agnostic.
+class Poller {
+public:
+	struct Event {
+		int		fd;
+		short	revents;
+	};
+
+	virtual ~Poller() {}
+
+	virtual const char	*name() const = 0;
+
+	// Register fd with the given interest. Returns false on duplicate/failure.
+	virtual bool	add(int fd, short events) = 0;
+	// Change interest for a registered fd; no-op when the interest is unchanged.
+	virtual bool	modify(int fd, short events) = 0;
+	// Forget fd (safe to call for unknown fds).
+	virtual void	remove(int fd) = 0;
+
+	// Wait up to timeoutMs (-1 = infinite) and append ready fds to out.
+	// Returns the number of ready fds, or -1 with errno set.
+	virtual int		wait(int timeoutMs, std::vector<Event> &out) = 0;
+
+	// Build a backend by name ("auto", "epoll", "poll"). Unknown or
+	// unavailable backends fall back to poll; err receives a note when that happens.
+	static Poller	*create(const std::string &backend, std::string *err);
+};
+
+#endif
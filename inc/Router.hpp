@@ -3,22 +3,60 @@
 
 #include <vector>
 #include <string>
-#include <algorithm>
-#include "ServerConfig.hpp"
+#include <stdint.h>
+#include <regex.h>
+#include "Location.hpp"
 
 struct RouteMatch {
 	const Location *loc; // null if no match
 	RouteMatch() : loc(NULL) {}
 };
 
+// Location lookup, built once per server when the config is loaded and only
+// read afterwards. Order (as in nginx): exact paths from a hash table, then
+// the longest prefix from a compressed radix tree; unless that prefix is
+// '^~', regex locations are tried in config order and the first match wins.
+// Only location indices are stored, so copies of the owning ServerConfig
+// stay valid; compiled regexes are shared between copies.
 class Router {
 public:
 	Router();
-	void build(const ServerConfig &srv);                 // capture pointers to locations, sorted by longest prefix first
-	RouteMatch match(const std::string &target) const;   // normalize and longest-prefix match
+	Router(const Router &other);
+	Router &operator=(Router other);
+	~Router();
+
+	void build(const std::vector<Location> &locs);  // throws InvalidFormat on a bad regex
+	int match(const std::string &target) const;     // location index, -1 if none
 private:
-	std::vector<const Location *> _locs;            // sorted by descending path length
-	std::string	normalize_target(const std::string &t) const;
+	struct Node {
+		std::string			label;     // edge label from the parent
+		int					loc;       // location whose path ends here, -1 if none
+		bool				priority;  // that location is '^~'
+		std::vector<size_t>	children;  // distinct first bytes
+	};
+	struct Exact {
+		std::string	path;
+		uint32_t	hash;
+		int			loc;
+	};
+	struct Regex {
+		regex_t		re;
+		int			loc;
+		unsigned	refs;
+	};
+
+	std::vector<Node>	_nodes;       // _nodes[0] is the root (empty label)
+	std::vector<Exact>	_exact;
+	std::vector<size_t>	_exactSlots;  // index into _exact + 1, 0 when empty
+	std::vector<Regex*>	_regex;       // config order
+
+	void	insert(const std::string &path, int loc, bool priority);
+	size_t	child(size_t node, char c) const;
+	int		matchExact(const std::string &target) const;
+	int		matchPrefix(const std::string &target, bool *priority) const;
+	int		matchRegex(const std::string &target) const;
+	void	releaseRegex();
+	void	swap(Router &other);
 };
 
 #endif // ROUTER_HPP
@@ -0,0 +1,27 @@
+#ifndef SCAN_HPP
+#define SCAN_HPP
+
+#include <cstddef>
+
+// Delimiter scanning for the request parser and the chunked decoder. Each
+// function returns the index of the first byte that stops the scan, or n
+// when the whole range passes. On x86 the work is done 16 (SSE2) or 32
+// (AVX2, picked at startup when the CPU has it) bytes at a time; other
+// targets use the scalar loops.
+
+// First CR or LF.
+size_t	scan_line_end(const char *p, size_t n);
+// First CRLF pair (index of its CR).
+size_t	scan_crlf(const char *p, size_t n);
+// First SP or control byte (end of a request-target).
+size_t	scan_target_end(const char *p, size_t n);
+// First byte that is not an RFC 9110 tchar (end of a header name).
+size_t	scan_token_end(const char *p, size_t n);
+
+// Name of the kernel in use, for the startup log.
+const char	*scan_kernel_name();
+// Switches to the named kernel ("scalar", "sse2", "avx2") when this build
+// and CPU have it; false otherwise. For benchmarks.
+bool		scan_use_kernel(const char *name);
+
+#endif
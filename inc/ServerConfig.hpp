@@ -3,6 +3,7 @@
 
 #include "WebServ.hpp"
 #include "Location.hpp"
+#include "Router.hpp"
 
 class ServerConfig {
 private:
@@ -16,6 +17,10 @@ private:
 	long long	client_max_body_size;
 	long long	max_headers_size;
 	long long	max_request_size;
+	long long	keepalive_timeout;   // ms, -1 when unset
+	long long	keepalive_requests;  // -1 when unset
+	LocationPlan	default_plan;    // requests that match no location
+	Router		router;              // over locations, built with the plans
 
 	void swap(ServerConfig &other);
 
@@ -30,6 +35,8 @@ public:
 	void	setClientMaxBodySize(long long size);
 	void	setMaxHeaderSize(long long size);
 	void	setMaxRequestSize(long long size);
+	void	setKeepaliveTimeout(long long ms);
+	void	setKeepaliveRequests(long long count);
 	void	addIndexBack(const std::string &index);
 	void	setIndex(const std::vector<std::string> &index);
 	void	addLocationBack(const Location &loc);
@@ -46,8 +53,16 @@ public:
 	long long		getClientMaxBodySize() const;
 	long long		getMaxHeaderSize() const;
 	long long		getMaxRequestSize() const;
+	long long		getKeepaliveTimeout() const;
+	long long		getKeepaliveRequests() const;
 	Location	findLocationForPath(std::string path) const;
 
+	// Resolve every location plan (and the default one) and build the
+	// location router; call once the server block has been parsed.
+	void	freezePlans();
+	const LocationPlan	&getDefaultPlan() const;
+	RouteMatch	route(const std::string &target) const;
+
 	std::string	bindKey();
 };
 
@@ -5,13 +5,22 @@
 
 class SignalHandler {
 public:
+	// What drain() reports (several signals may be pending at once)
+	enum Pending {
+		STOP = 1,       // SIGINT / SIGTERM: graceful shutdown
+		UPGRADE = 2,    // SIGUSR2: start a new binary and hand over listeners
+		RELOAD = 4,     // SIGHUP: re-read the configuration
+		CHILD = 8       // SIGCHLD: a child exited
+	};
+
 	SignalHandler();
 	~SignalHandler();
 
 	static bool install();
 	static void uninstall();
 	static int readFd();
-	static void drain();
+	// Empty the self-pipe; returns an OR of Pending bits
+	static int drain();
 
 private:
 	static void onSignal(int signo);
@@ -21,10 +21,14 @@ public:
 
 	bool openIPv4(std::string *err);
 	bool setReuseAddr(std::string *err);
+	bool setReusePort(std::string *err);
 	bool setNonBlocking(std::string *err);
 	bool bind(const Address &addr, std::string *err);
 	bool listen(int backlog, std::string *err);
 
+	// Take ownership of an already open socket (e.g. inherited across exec)
+	void adopt(int fd);
+
 	int fd() const;
 	void close() throw();
 
@@ -0,0 +1,47 @@
+#ifndef TIMERQUEUE_HPP
+#define TIMERQUEUE_HPP
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+// Min-heap of per-key deadlines (keys are small ints, e.g. client fds).
+// At most one deadline is live per key. Arming a later deadline than the one
+// already pending is a no-op: the earlier entry fires, the owner re-checks and
+// re-arms with its real next deadline. This keeps activity (which only ever
+// pushes the idle deadline later) from touching the heap at all.
+class TimerQueue {
+public:
+	TimerQueue();
+
+	void	arm(int key, uint64_t deadline);
+	void	cancel(int key);
+	bool	armed(int key) const;
+
+	// Milliseconds until the nearest deadline, clamped to [0, maxMs];
+	// -1 when nothing is armed and maxMs is -1.
+	int		timeoutMs(uint64_t now, int maxMs);
+
+	// Disarm and append every key whose deadline is <= now.
+	void	expire(uint64_t now, std::vector<int> &out);
+
+	size_t	size() const { return _live; }
+
+private:
+	struct Entry {
+		uint64_t	when;
+		int			key;
+	};
+	struct Later {
+		bool operator()(const Entry &a, const Entry &b) const { return a.when > b.when; }
+	};
+
+	std::vector<Entry>		_heap;
+	std::vector<uint64_t>	_deadline; // key -> live deadline, 0 when disarmed
+	size_t					_live;
+
+	bool	isStale(const Entry &e) const;
+	void	dropStaleTop();
+};
+
+#endif
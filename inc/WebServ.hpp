@@ -15,6 +15,7 @@
 #include <cstring>
 #include <algorithm>
 #include <dirent.h>
+#include <unistd.h>
 
 #include <stdint.h>
 
@@ -0,0 +1,51 @@
+#ifndef WORKERPOOL_HPP
+#define WORKERPOOL_HPP
+
+#include <vector>
+#include <sys/types.h>
+
+// Pre-forked worker processes. Each worker runs its own EventLoop with its own
+// SO_REUSEPORT listeners, so the kernel spreads accepts across workers and no
+// state is shared on the hot path. The master only supervises: it forwards
+// SIGINT/SIGTERM (each worker then drains gracefully) and SIGHUP (each worker
+// reloads its configuration), and respawns workers that die unexpectedly.
+// SIGUSR2 starts a new instance of the binary next to the running workers
+// (see Handoff).
+class WorkerPool {
+public:
+	typedef int (*WorkerMain)(void *ctx);
+
+	// Exit status a worker uses to report a startup failure (no respawn).
+	static const int STARTUP_FAILURE = 2;
+
+	WorkerPool(size_t count, WorkerMain fn, void *ctx);
+	~WorkerPool();
+
+	// Called in the master on SIGHUP so respawned workers start from the
+	// reloaded configuration too.
+	typedef void (*ReloadHook)(void *ctx);
+	void	setReloadHook(ReloadHook fn) { _onReload = fn; }
+
+	// In the master: supervise until shutdown, return the exit code, *isWorker = false.
+	// In a worker: run fn(ctx) and return its exit code, *isWorker = true.
+	int run(bool *isWorker);
+
+private:
+	size_t				_count;
+	WorkerMain			_fn;
+	void				*_ctx;
+	std::vector<pid_t>	_pids;
+	pid_t				_upgradePid;
+	ReloadHook			_onReload;
+
+	pid_t	spawn(size_t slot);
+	int		slotOf(pid_t pid) const;
+	void	signalAll(int signo);
+	void	waitAll();
+	void	upgrade();
+
+	WorkerPool(const WorkerPool &);
+	WorkerPool &operator=(const WorkerPool &);
+};
+
+#endif
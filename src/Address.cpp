@@ -23,6 +23,23 @@ Address Address::fromHostPort(const uint32_t host, const uint16_t port) {
 	return out;
 }
 
+Address Address::ofSocket(int fd) {
+	Address out;
+	socklen_t len = sizeof(out._sa);
+	if (::getsockname(fd, reinterpret_cast<struct sockaddr*>(&out._sa), &len) == -1
+		|| len != sizeof(out._sa) || out._sa.sin_family != AF_INET) {
+		return Address();
+	}
+	out._len = len;
+	return out;
+}
+
+bool Address::sameAs(const Address &other) const {
+	return valid() && other.valid()
+		&& _sa.sin_port == other._sa.sin_port
+		&& _sa.sin_addr.s_addr == other._sa.sin_addr.s_addr;
+}
+
 bool Address::valid() const {
 	return _len == sizeof(_sa) && _sa.sin_family == AF_INET;
 }
@@ -0,0 +1,21 @@
+#include "../inc/ConfigGeneration.hpp"
+
+unsigned long	ConfigGeneration::s_nextId = 1;
+
+ConfigGeneration::ConfigGeneration(const std::vector<ServerConfig> &configs, long acceptBudget)
+		: _configs(configs), _acceptBudget(acceptBudget), _id(s_nextId++), _refs(1) {
+	// Pointers into _configs stay valid: the vector is never modified afterwards
+	for (size_t i = 0; i < _configs.size(); ++i) {
+		_binds[_configs[i].bindKey()].push_back(&_configs[i]);
+	}
+}
+
+ConfigGeneration::~ConfigGeneration() {}
+
+void ConfigGeneration::retain() {
+	++_refs;
+}
+
+void ConfigGeneration::release() {
+	if (--_refs == 0) delete this;
+}
@@ -1,23 +1,48 @@
 #include "../inc/Connection.hpp"
 
+// Not on every platform; SignalHandler also ignores SIGPIPE process-wide
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
 static const uint64_t IDLE_TIMEOUT_MS = 15000ULL;
 static const uint64_t WRITE_DRAIN_TIMEOUT_MS = 10000ULL;
+static const uint64_t CGI_TIMEOUT_MS = 5000ULL;
+static const uint64_t DEFAULT_KEEPALIVE_TIMEOUT_MS = 15000ULL;
+static const size_t DEFAULT_KEEPALIVE_REQUESTS = 1000;
+// Pipelining: stop reading new requests while this many responses (or bytes)
+// are waiting to be sent
+static const size_t MAX_PIPELINE_DEPTH = 16;
+static const size_t MAX_PIPELINE_OUTPUT = 1024 * 1024;
+// Output: memory blocks grow up to this size before a new one is started,
+// and at most this many blocks go into one sendmsg(2)
+static const size_t OUT_SEGMENT_SIZE = 64 * 1024;
+static const size_t OUT_IOV_MAX = 64;
+// CGI output: stop reading the child above the high mark of queued output,
+// resume below the low one
+static const size_t CGI_OUTPUT_HIGH = 256 * 1024;
+static const size_t CGI_OUTPUT_LOW = 64 * 1024;
+// CGI input: request body bytes waiting for the child's stdin before the
+// socket stops being read
+static const size_t CGI_INPUT_MAX = 64 * 1024;
+
+// Until a request has been routed
+static const LocationPlan NO_PLAN;
 
 Connection::Connection(int fd, const std::vector<const ServerConfig*> &group, const std::string &bindKey, EventLoop* loop)
-		: _fd(fd), _closed(false), _group(group), _srv(0), _bindKey(bindKey), _vhostName("-"),_routerSrv(0),
-		  _headersDone(false), _bodyState(BODY_NONE), _bodyLimit(-1), _clRemaining(0),
+		: _fd(fd), _closed(false), _group(group), _srv(0), _bindKey(bindKey), _vhostName("-"),
+		  _outMem(0), _corked(false), _queuedTotal(0), _sentTotal(0), _respStart(0), _closing(false),
+		  _headersDone(false), _bodyState(BODY_NONE), _bodyLimit(-1), _clRemaining(0), _bodyReceived(0),
 		  _chunkRemaining(-1), _chunkReadingTrailers(false), _drainAfterResponse(false),
+		  _keepAlive(false), _reqHasBody(false), _idle(false), _requests(0), _keepaliveMs(DEFAULT_KEEPALIVE_TIMEOUT_MS),
 		  _t_start(now_ms()), _t_last_active(_t_start), _t_headers_start(_t_start), _t_write_start(0),
-		  _bytes_sent(0), _status_code(0), _logged(false), _reqLine("-"), _peer(peer_of(fd)),
-		  _loop(loop), _cgiState(CGI_NONE), _cgiPid(-1), _cgiIn(-1), _cgiOut(-1), _t_cgi_start(0),
-		  _cgiHeadersDone(false), _cgiStatusFromCGI(0), _cgiOutputSent(0),
-		  _cgiEnabled(false) {
+		  _status_code(0), _reqLine("-"), _peer(peer_of(fd)),
+		  _loop(loop), _cgiState(CGI_NONE), _cgiPid(-1), _cgiIn(-1), _cgiOut(-1), _t_cgi_active(0),
+		  _cgiHeadersDone(false), _cgiStatusFromCGI(0), _cgiContentLength(-1), _cgiInOff(0), _cgiOutputSent(0),
+		  _cgiChunked(false), _cgiPaused(false),
+		  _cgiEnabled(false), _plan(&NO_PLAN), _uploadFd(-1) {
 	if (!_group.empty() && _group[0]) {
 		_srv = _group[0];
-		_root = _srv->getRoot();
-		_index = _srv->getIndex();
-		_router.build(*_srv);
-		_routerSrv = _srv;
 		// Apply parser limits from server config (with sane defaults)
 		size_t maxRL = (_srv->getClientMaxBodySize() >= 0) ? (size_t)_srv->getClientMaxBodySize() : 4096u;
 		size_t maxHL = (_srv->getMaxHeaderSize() >= 0) ? (size_t)_srv->getMaxHeaderSize() : 16384u;
@@ -27,48 +52,365 @@ Connection::Connection(int fd, const std::vector<const ServerConfig*> &group, co
 		// Default limits if no server configured (shouldn't happen)
 		_parser.setLimits(4096u, 16384u, 100u);
 	}
+	armTimer();
 }
 
 Connection::~Connection() {
 	closeCgiPipes();
-	if (_cgiPid > 0) { (void)::kill(_cgiPid, SIGKILL); (void)::waitpid(_cgiPid, 0, WNOHANG); _cgiPid = -1; }
+	if (_cgiPid > 0) (void)::kill(_cgiPid, SIGKILL);
+	releaseCgiChild();
 	closeFd();
 }
 
 bool Connection::wantRead() const {
-	return !_closed && (_wbuf.empty() || _drainAfterResponse);
+	// The next request is read once the current response is complete, while
+	// earlier ones may still be waiting to be sent
+	if (_closed) return false;
+	if (_drainAfterResponse) return true;
+	// Body for a running CGI: read while the child keeps up
+	if (cgiAwaitingBody()) return _bodyBuf.size() - _cgiInOff < CGI_INPUT_MAX;
+	return !_closing && !responseStarted() && !pipelineFull();
 }
 
 bool Connection::wantWrite() const {
-	return !_closed && !_wbuf.empty();
+	return !_closed && !_out.empty();
 }
 
 void	Connection::enableDrain() {
 	_drainAfterResponse = true;
+	_keepAlive = false;
+	interestChanged();
+}
+
+void	Connection::interestChanged() {
+	if (_loop && !_closed) _loop->markDirty(_fd);
+}
+
+void	Connection::armTimer() {
+	if (_loop && !_closed) _loop->armTimer(_fd, nextDeadline());
+}
+
+void	Connection::markWriteStart() {
+	_t_write_start = now_ms();
+	armTimer();
+	interestChanged();
+}
+
+static uint64_t earliest(uint64_t a, uint64_t b) {
+	if (a == 0) return b;
+	if (b == 0) return a;
+	return a < b ? a : b;
 }
 
-void Connection::logAccess() {
-	if (_logged) return;
-	uint64_t dur = now_ms() - _t_start;
+// The CGI timeout runs while the child owes us progress: not while its
+// output is held back for the client, nor while it waits for body bytes
+// the client has not sent yet (the read idle timeout covers that)
+bool Connection::cgiClockRunning() const {
+	if (_cgiState != CGI_STREAMING || _cgiPaused || _t_cgi_active == 0) return false;
+	return !(cgiAwaitingBody() && _cgiInOff == _bodyBuf.size());
+}
+
+uint64_t Connection::nextDeadline() const {
+	if (_closed) return 0;
+	uint64_t d = 0;
+	if (cgiClockRunning()) d = earliest(d, _t_cgi_active + CGI_TIMEOUT_MS);
+	if (_out.empty()) d = earliest(d, _t_last_active + (_idle ? _keepaliveMs : IDLE_TIMEOUT_MS));
+	else if (_t_write_start != 0) d = earliest(d, _t_write_start + WRITE_DRAIN_TIMEOUT_MS);
+	return d;
+}
+
+bool Connection::pipelineFull() const {
+	return _outq.size() >= MAX_PIPELINE_DEPTH || _outMem >= MAX_PIPELINE_OUTPUT;
+}
+
+Connection::QueuedResponse Connection::currentResponse() const {
+	QueuedResponse r;
+	r.start = _respStart;
+	r.end = _queuedTotal;
+	r.status = _status_code;
+	r.keepAlive = _keepAlive && !(_loop && _loop->shuttingDown());
+	r.t_start = _t_start;
+	r.reqLine = _reqLine;
+	r.vhost = _vhostName;
+	return r;
+}
+
+void Connection::logAccess(const QueuedResponse &r) {
+	uint64_t dur = now_ms() - r.t_start;
+	uint64_t sent = 0;
+	if (_sentTotal > r.start) sent = (_sentTotal < r.end ? _sentTotal : r.end) - r.start;
 	Logger::accessf("%s [%s] vhost=%s \"%s\" %d %zu dur_ms=%llu",
-					_peer.c_str(), _bindKey.c_str(), _vhostName.c_str(), _reqLine.c_str(),
-					_status_code, (size_t)_bytes_sent,
+					_peer.c_str(), _bindKey.c_str(), r.vhost.c_str(), r.reqLine.c_str(),
+					r.status, (size_t)sent,
 					(unsigned long long)dur);
-	_logged = true;
+}
+
+void Connection::appendOutput(const char *data, size_t len) {
+	if (len == 0) return;
+	while (len > 0) {
+		if (_out.empty() || _out.back().fd != -1 || _out.back().data.size() >= OUT_SEGMENT_SIZE) {
+			_out.push_back(OutSegment());
+			_out.back().consumed = 0;
+			_out.back().fd = -1;
+			_out.back().offset = 0;
+			_out.back().length = 0;
+			_out.back().buffered = false;
+		}
+		std::vector<char> &tail = _out.back().data;
+		size_t room = OUT_SEGMENT_SIZE - tail.size();
+		if (tail.empty() && len > room) room = len; // a large block is kept whole
+		size_t take = (len < room) ? len : room;
+		tail.insert(tail.end(), data, data + take);
+		data += take;
+		len -= take;
+		_outMem += take;
+		_queuedTotal += take;
+	}
+}
+
+void Connection::appendOutput(const std::vector<char> &data) {
+	if (!data.empty()) appendOutput(&data[0], data.size());
+}
+
+void Connection::appendFile(int fd, off_t offset, size_t length) {
+	if (length == 0) {
+		::close(fd);
+		return;
+	}
+	_out.push_back(OutSegment());
+	OutSegment &seg = _out.back();
+	seg.consumed = 0;
+	seg.fd = fd;
+	seg.offset = offset;
+	seg.length = length;
+	seg.buffered = false;
+	_queuedTotal += length;
+	// Hold partial frames so the head leaves together with the first body bytes
+	setCork(true);
+}
+
+void Connection::appendResponse(const HttpResponse &resp) {
+	std::vector<char> bytes = resp.serialize();
+	if (bytes.size() < OUT_SEGMENT_SIZE) {
+		appendOutput(bytes);
+	} else {
+		// Large generated body: becomes a block of its own without a copy
+		_out.push_back(OutSegment());
+		OutSegment &seg = _out.back();
+		seg.data.swap(bytes);
+		seg.consumed = 0;
+		seg.fd = -1;
+		seg.offset = 0;
+		seg.length = 0;
+		seg.buffered = false;
+		_outMem += seg.data.size();
+		_queuedTotal += seg.data.size();
+	}
+	if (resp.fileFd() != -1) appendFile(resp.fileFd(), resp.fileOffset(), resp.fileLength());
+}
+
+void Connection::dropOutput(uint64_t len) {
+	while (len > 0 && !_out.empty() && _out.back().fd == -1) {
+		OutSegment &tail = _out.back();
+		size_t unsent = tail.data.size() - tail.consumed;
+		size_t cut = (len < unsent) ? (size_t)len : unsent;
+		tail.data.resize(tail.data.size() - cut);
+		_outMem -= cut;
+		_queuedTotal -= cut;
+		len -= cut;
+		if (tail.consumed == tail.data.size()) {
+			if (tail.consumed != 0) break; // the rest already went out
+			_out.pop_back();
+		}
+	}
+}
+
+void Connection::clearOutput() {
+	for (size_t i = 0; i < _out.size(); ++i) {
+		if (_out[i].fd != -1) ::close(_out[i].fd);
+	}
+	_out.clear();
+	_outMem = 0;
+}
+
+void Connection::setCork(bool on) {
+#ifdef TCP_CORK
+	if (on == _corked || _closed) return;
+	int v = on ? 1 : 0;
+	(void)::setsockopt(_fd, IPPROTO_TCP, TCP_CORK, &v, sizeof(v));
+	_corked = on;
+#else
+	(void)on;
+#endif
+}
+
+void Connection::decideKeepAlive(const HttpRequest &req) {
+	++_requests;
+	// HTTP/1.1 is persistent unless the client asks to close; 1.0 only on request
+	std::string conn = to_lower_copy(req.headers.get(HttpHeaders::H_CONNECTION));
+	if (req.version == "HTTP/1.1")
+		_keepAlive = conn.find("close") == std::string::npos;
+	else
+		_keepAlive = conn.find("keep-alive") != std::string::npos;
+
+	long long timeout = _srv ? _srv->getKeepaliveTimeout() : -1;
+	long long maxRequests = _srv ? _srv->getKeepaliveRequests() : -1;
+	_keepaliveMs = (timeout >= 0) ? (uint64_t)timeout : DEFAULT_KEEPALIVE_TIMEOUT_MS;
+	size_t limit = (maxRequests >= 0) ? (size_t)maxRequests : DEFAULT_KEEPALIVE_REQUESTS;
+	if (_keepaliveMs == 0 || _requests >= limit) _keepAlive = false;
+
+	std::string cl = req.headers.get(HttpHeaders::H_CONTENT_LENGTH);
+	_reqHasBody = !req.headers.get(HttpHeaders::H_TRANSFER_ENCODING).empty() || (!cl.empty() && cl != "0");
+}
+
+void Connection::setConnectionHeader(HttpResponse &resp) {
+	// An unread (or rejected) body would be parsed as the next request
+	if (_drainAfterResponse || (_reqHasBody && _bodyState != BODY_DONE) || (_loop && _loop->shuttingDown()))
+		_keepAlive = false;
+	resp.setHeader("Connection", _keepAlive ? "keep-alive" : "close");
+}
+
+// Hand finished responses to the writer and answer requests that were read
+// ahead, as long as the queue has room
+bool Connection::advance() {
+	for (;;) {
+		if (_closed) return false;
+		if (_status_code != 0) {
+			// CGI still producing it, or the connection ends with it
+			if (_cgiState == CGI_STREAMING || _drainAfterResponse) return true;
+			if (!completeResponse()) return false;
+			continue;
+		}
+		if (_headersDone || _closing || _rbuf.empty() || pipelineFull()) return true;
+		std::string pending;
+		pending.swap(_rbuf);
+		if (consumeInput(pending.data(), pending.size()) == -1) return false;
+	}
+}
+
+bool Connection::completeResponse() {
+	_outq.push_back(currentResponse());
+	_respStart = _queuedTotal;
+	if (!_outq.back().keepAlive) _closing = true;
+	resetRequest();
+	return retireSent();
+}
+
+bool Connection::retireSent() {
+	while (!_outq.empty() && _outq.front().end <= _sentTotal) {
+		logAccess(_outq.front());
+		_outq.pop_front();
+	}
+	if (_outq.empty() && !responseStarted()
+		&& (_closing || (isIdle() && _loop && _loop->shuttingDown()))) {
+		closeFd();
+		return false;
+	}
+	return true;
+}
+
+void Connection::resetRequest() {
+	// Bytes already read past this request belong to the next one
+	std::string rest;
+	_parser.takeRemaining(rest);
+	rest.append(_rbuf);
+	_parser.reset();
+	if (_closing) rest.clear();
+	_rbuf.swap(rest);
+	_headersDone = false;
+	_req = HttpRequest();
+
+	_bodyState = BODY_NONE;
+	std::string().swap(_bodyBuf);
+	_bodyLimit = -1;
+	_clRemaining = 0;
+	_bodyReceived = 0;
+	_chunkRemaining = -1;
+	_chunkReadingTrailers = false;
+
+	releaseCgiChild();
+	_cgiState = CGI_NONE;
+	_t_cgi_active = 0;
+	_cgiHdrBuf.clear();
+	_cgiHeadersDone = false;
+	_cgiStatusFromCGI = 0;
+	_cgiHdrs.clear();
+	_cgiContentLength = -1;
+	_cgiInOff = 0;
+	_cgiOutputSent = 0;
+	_cgiChunked = false;
+	_cgiPaused = false;
+	_cgiEnabled = false;
+	_locCgiPath.clear();
+	discardUpload();
+	_plan = &NO_PLAN;
+
+	// Back to the default server until the next Host header
+	if (!_group.empty() && _group[0] && _srv != _group[0]) {
+		_srv = _group[0];
+	}
+	_vhostName = "-";
+
+	_t_start = now_ms();
+	_t_headers_start = _t_start;
+	_status_code = 0;
+	_reqLine = "-";
+	_keepAlive = false;
+	_reqHasBody = false;
+	_idle = _rbuf.empty();
+	armTimer();
+	interestChanged();
 }
 
 void Connection::closeFd() {
+	discardUpload();
 	if (!_closed && _fd >= 0) {
-		if (_status_code != 0) logAccess();
+		// Responses cut short by the close are logged with what was sent
+		for (size_t i = 0; i < _outq.size(); ++i) logAccess(_outq[i]);
+		_outq.clear();
+		if (_status_code != 0) logAccess(currentResponse());
+		clearOutput();
 		::close(_fd);
 		_fd = -1;
 		_closed = true;
 	}
 }
 
+// The loop reaps a child that has not exited yet, so no pid is dropped
+// while it can still turn into a zombie
+void Connection::releaseCgiChild() {
+	if (_cgiPid <= 0) return;
+	if (_loop) _loop->adoptChild(_cgiPid);
+	else (void)::waitpid(_cgiPid, 0, WNOHANG);
+	_cgiPid = -1;
+}
+
+bool Connection::abortCgi() {
+	if (_cgiPid > 0) (void)::kill(_cgiPid, SIGKILL);
+	releaseCgiChild();
+	closeCgiPipes();
+	if (_cgiState != CGI_NONE) _cgiState = CGI_DONE;
+	if (!_cgiHeadersDone) return true;
+	if (_sentTotal > _respStart) return false;
+	// Nothing of it was sent yet: drop the queued CGI output, an error replaces it
+	dropOutput(_queuedTotal - _respStart);
+	_status_code = 0;
+	return true;
+}
+
+bool Connection::failCgi(const HttpStatusCode::e &status) {
+	if (!abortCgi()) {
+		closeFd();
+		return false;
+	}
+	returnHttpResponse(status);
+	return true;
+}
+
 void Connection::closeCgiPipes() {
-	if (_cgiIn != -1) { ::close(_cgiIn); _cgiIn = -1; }
-	if (_cgiOut != -1) { ::close(_cgiOut); _cgiOut = -1; }
+	// Unregister before closing so the backend never holds a stale fd
+	if (_cgiIn != -1) { if (_loop) _loop->unregisterAuxFd(_cgiIn); ::close(_cgiIn); _cgiIn = -1; }
+	if (_cgiOut != -1) { if (_loop) _loop->unregisterAuxFd(_cgiOut); ::close(_cgiOut); _cgiOut = -1; }
 }
 
 std::string Connection::getMimeType(const std::string &path) {
@@ -96,9 +438,9 @@ std::string Connection::getMimeType(const std::string &path) {
 	return "application/octet-stream";
 }
 
-bool	Connection::handle(const std::string &root, const std::vector<std::string> &indexList, const HttpRequest &req, bool isHead,
+bool	Connection::handle(const std::string &root, const std::vector<std::string> &indexList, const std::string &target, bool isHead,
 						   bool autoindex, HttpResponse &outResp, const Location *loc, std::string &err) {
-	std::string clean = sanitize(req.target);
+	std::string clean = sanitize(target);
 	std::string path = join_path_relative(root, clean);
 
 	bool isDir = false;
@@ -128,14 +470,14 @@ bool	Connection::handle(const std::string &root, const std::vector<std::string>
 				err = "index denied";
 				return false;
 			}
-			bool		deleteMethod = (loc && loc->findMethod("DELETE") != std::string::npos);
+			bool		deleteMethod = (loc && loc->listsMethod(METHOD_DELETE));
 			std::string body;
 			if (!generate_autoindex_tree(path, clean, body, deleteMethod)) {
 				err = "autoindex generation failed";
 				return false;
 			}
 			outResp.setStatus(HttpStatusCode::OK);
-			outResp.setHeader("Connection", "close");
+			setConnectionHeader(outResp);
 			outResp.setHeader("Content-Type", "text/html; charset=utf-8");
 			{
 				std::ostringstream oss; oss << body.size();
@@ -146,68 +488,62 @@ bool	Connection::handle(const std::string &root, const std::vector<std::string>
 		}
 	}
 
-	std::string body;
 	long contentLen = 0;
 	struct stat st;
 	if (::stat(path.c_str(), &st) == 0) {
 		contentLen = static_cast<long>(st.st_size);
 	}
+	int fd = -1;
 	if (!isHead) {
-		if (!read_file(path, body)) {
+		// The body goes out straight from the file (see appendResponse)
+		fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd == -1 || ::fstat(fd, &st) != 0) {
 			err = std::string("read error: ") + std::strerror(errno);
-			return false; // treat as 404/500; for v0 we’ll do 404
+			if (fd != -1) ::close(fd);
+			return false;
 		}
-		contentLen = static_cast<long>(body.size());
+		contentLen = static_cast<long>(st.st_size);
 	}
 
 	outResp.setStatus(HttpStatusCode::OK);
-	outResp.setHeader("Connection", "close");
+	setConnectionHeader(outResp);
 	outResp.setHeader("Content-Type", getMimeType(path));
 	{
 		std::ostringstream oss; oss << contentLen;
 		outResp.setHeader("Content-Length", oss.str());
 	}
-	if (!isHead) outResp.setBody(body);
+	if (fd != -1) outResp.setFileBody(fd, 0, (size_t)contentLen);
 	return true;
 }
 
 bool Connection::checkTimeouts(uint64_t now_ms) {
 	if (_closed) return false;
-	// Reading stage (headers or body)
-	if (_wbuf.empty()) {
-		bool headersStage = !_headersDone;
-		if (headersStage) {
-			// Apply both idle and headers timeout while waiting for headers
-			//uint64_t effHeadersTimeout = HEADERS_TIMEOUT_MS;
-			//if (_srv && _srv->header_timeout_ms >= 0) effHeadersTimeout = (uint64_t)_srv->header_timeout_ms;
-			if ((now_ms - _t_last_active) > IDLE_TIMEOUT_MS/* || (now_ms - _t_headers_start) > effHeadersTimeout*/) {
-				if (_status_code == 0) {
-					returnHttpResponse(HttpStatusCode::RequestTimeout);
-					return true; // switch to write
-				}
+	// CGI execution timeout applies whether or not output has started
+	if (cgiClockRunning() && (now_ms - _t_cgi_active) >= CGI_TIMEOUT_MS) {
+		LOG_WARNF("cgi timeout for fd=%d after %llu ms", _fd, (unsigned long long)(now_ms - _t_cgi_active));
+		if (!failCgi(HttpStatusCode::GatewayTimeout)) return false;
+		return advance();
+	}
+	// Reading stage (headers or body): idle timeout
+	if (_out.empty()) {
+		if ((now_ms - _t_last_active) >= (_idle ? _keepaliveMs : IDLE_TIMEOUT_MS)) {
+			if (cgiAwaitingBody()) {
+				if (!failCgi(HttpStatusCode::RequestTimeout)) return false;
+				return advance();
 			}
-		} else {
-			// Body stage: only idle timeout applies
-			if ((now_ms - _t_last_active) > IDLE_TIMEOUT_MS) {
-				if (_status_code == 0) {
-					returnHttpResponse(HttpStatusCode::RequestTimeout);
-					return true;
-				}
+			if (_status_code == 0 && !_idle) {
+				returnHttpResponse(HttpStatusCode::RequestTimeout);
+				return advance(); // switch to write
 			}
+			// Idle keep-alive connection, or response already sent (draining
+			// the rest of a rejected body): give up
+			closeFd();
+			return false;
 		}
 		return true;
 	}
-	// CGI execution timeout (e.g., 5s)
-	const uint64_t CGI_TIMEOUT_MS = 5000ULL;
-	if (_cgiState != CGI_NONE && _cgiState != CGI_DONE && _t_cgi_start != 0 && (now_ms - _t_cgi_start) > CGI_TIMEOUT_MS) {
-		LOG_WARNF("cgi timeout for fd=%d after %llu ms", _fd, (unsigned long long)(now_ms - _t_cgi_start));
-		if (_cgiPid > 0) { (void)::kill(_cgiPid, SIGKILL); (void)::waitpid(_cgiPid, 0, WNOHANG); _cgiPid = -1; }
-		closeCgiPipes();
-		returnHttpResponse(HttpStatusCode::GatewayTimeout);
-		return true;
-	}
 	// Writing stage
-	if (_t_write_start != 0 && (now_ms - _t_write_start) > WRITE_DRAIN_TIMEOUT_MS) {
+	if (_t_write_start != 0 && (now_ms - _t_write_start) >= WRITE_DRAIN_TIMEOUT_MS) {
 		LOG_WARNF("write drain timeout for fd=%d after %llu ms", _fd, (unsigned long long)(now_ms - _t_write_start));
 		closeFd();
 		return false;
@@ -247,10 +583,10 @@ void Connection::returnOKResponse(std::string body, std::string content_type) {
 	std::ostringstream	oss;
 	oss << body.size();
 	resp.setHeader("Content-Length", oss.str());
-	resp.setHeader("Connection", "close");
-	_wbuf = resp.serialize();
+	setConnectionHeader(resp);
+	appendResponse(resp);
 	_status_code = 200;
-	_t_write_start = now_ms();
+	markWriteStart();
 }
 
 void	Connection::returnHttpResponse(const HttpStatusCode::e &status_code) {
@@ -262,10 +598,10 @@ void	Connection::returnHttpResponse(const HttpStatusCode::e &status_code) {
 	std::ostringstream	oss;
 	oss << body.size();
 	resp.setHeader("Content-Length", oss.str());
-	resp.setHeader("Connection", "close");
-	_wbuf = resp.serialize();
+	setConnectionHeader(resp);
+	appendResponse(resp);
 	_status_code = statusCodeToInt(status_code);
-	_t_write_start = now_ms();
+	markWriteStart();
 }
 
 void	Connection::returnOtherResponse(const HttpStatusCode::e &status_code, const std::string &location) {
@@ -280,10 +616,10 @@ void	Connection::returnOtherResponse(const HttpStatusCode::e &status_code, const
 	std::ostringstream	oss;
 	oss << body.size();
 	resp.setHeader("Content-Length", oss.str());
-	resp.setHeader("Connection", "close");
-	_wbuf = resp.serialize();
+	setConnectionHeader(resp);
+	appendResponse(resp);
 	_status_code = statusCodeToInt(status_code);
-	_t_write_start = now_ms();
+	markWriteStart();
 }
 
 void	Connection::returnHttpResponse(const HttpStatusCode::e &status_code, const std::string &allow) {
@@ -296,21 +632,18 @@ void	Connection::returnHttpResponse(const HttpStatusCode::e &status_code, const
 	std::ostringstream	oss;
 	oss << body.size();
 	resp.setHeader("Content-Length", oss.str());
-	resp.setHeader("Connection", "close");
-	_wbuf = resp.serialize();
+	setConnectionHeader(resp);
+	appendResponse(resp);
 	_status_code = statusCodeToInt(status_code);
-	_t_write_start = now_ms();
+	markWriteStart();
 }
 
-void Connection::returnCreatedResponse(const std::string &location, const size_t sizeBytes) {
+void Connection::returnCreatedResponse(const std::string &location, const std::string &summary) {
 	HttpResponse	resp(HttpStatusCode::Created);
 	std::string		content_type = "text/plain; charset=utf-8";
 	std::string		body = errorPageSetup(HttpStatusCode::Created, content_type, false);
-	if (body.empty()) {
-		std::ostringstream	bss;
-		bss << "Uploaded " << sizeBytes << " bytes to " << location << std::endl;
-		body = bss.str();
-	}
+	if (body.empty())
+		body = summary;
 	if (!location.empty())
 		resp.setHeader("Location", location);
 	resp.setHeader("Content-Type", content_type);
@@ -318,10 +651,10 @@ void Connection::returnCreatedResponse(const std::string &location, const size_t
 	std::ostringstream	oss;
 	oss << body.size();
 	resp.setHeader("Content-Length", oss.str());
-	resp.setHeader("Connection", "close");
-	_wbuf = resp.serialize();
+	setConnectionHeader(resp);
+	appendResponse(resp);
 	_status_code = 201;
-	_t_write_start = now_ms();
+	markWriteStart();
 }
 
 void Connection::returnHttpResponse(const ReturnDir &dir) {
@@ -339,14 +672,14 @@ void Connection::returnHttpResponse(const ReturnDir &dir) {
 	std::ostringstream	oss;
 	oss << body.size();
 	resp.setHeader("Content-Length", oss.str());
-	resp.setHeader("Connection", "close");
-	_wbuf = resp.serialize();
+	setConnectionHeader(resp);
+	appendResponse(resp);
 	_status_code = dir.code;
-	_t_write_start = now_ms();
+	markWriteStart();
 }
 
 bool Connection::startCgiCurrent() {
-	return startCgiWith(_locCgiPass, _locCgiPath, _effRootForRequest, _req);
+	return startCgiWith(_plan->cgiPass, _locCgiPath, _plan->root, _req);
 }
 
 // Process any bytes in _rbuf as chunked-encoding data; return false to close
@@ -368,69 +701,18 @@ bool Connection::processChunkedBuffered() {
 				// Discard trailers
 				_rbuf.erase(0, pos2 + 4);
 			}
-			// Body complete — launch CGI if configured; else same finalize path as fixed length
-			if (_cgiEnabled) {
-				startCgiCurrent();
-				return true;
-			}
-			if (!_uploadStore.empty()) {
-				std::string target = normalize_target_simple(_req.target);
-				std::string suffix;
-				if (!_matchedLocPath.empty() && target.size() >= _matchedLocPath.size() && target.compare(0, _matchedLocPath.size(), _matchedLocPath) == 0) {
-					suffix = target.substr(_matchedLocPath.size());
-				} else {
-					suffix = target;
-				}
-				std::string name = base_name_only(suffix);
-				if (name.empty() || (!suffix.empty() && suffix[suffix.size()-1] == '/')) {
-					name = gen_unique_upload_name();
-				} else {
-					name = safe_filename(name);
-				}
-				std::string full = join_path_relative(_uploadStore, name);
-				bool existed = false; struct stat st; if (::stat(full.c_str(), &st) == 0) existed = S_ISREG(st.st_mode);
-				FILE *f = std::fopen(full.c_str(), "wb");
-				if (!f) {
-					returnHttpResponse(HttpStatusCode::InternalServerError);
-					return true;
-				}
-				size_t total = 0; const char *p = _bodyBuf.data(); size_t left = _bodyBuf.size();
-				while (left > 0) {
-					size_t w = std::fwrite(p + total, 1, left, f); if (w == 0) break;
-					total += w;
-					left -= w;
-				}
-				std::fclose(f);
-				if (total != _bodyBuf.size()) {
-					returnHttpResponse(HttpStatusCode::InternalServerError);
-					return true;
-				}
-				std::string url = _matchedLocPath; if (url.empty()) url = "/"; if (url[url.size()-1] != '/') url += "/"; url += name;
-				if (existed) {
-					std::ostringstream body; body << "Uploaded " << total << " bytes to " << url << " (overwritten)\n";
-					returnOKResponse(body.str(), "text/plain; charset=utf-8");
-				} else {
-					returnCreatedResponse(url, total);
-				}
-				return true;
-			} else {
-				// Placeholder 200 when no upload_store configured
-				std::ostringstream body; body << "Received " << _bodyBuf.size() << " bytes\n";
-				returnOKResponse(body.str(), "text/plain; charset=utf-8");
-				return true;
-			}
+			// Body complete — same finalize path as fixed length
+			uploadAndRespond();
+			return true;
 		}
 
 		// Expecting size line?
-		if (_chunkRemaining < 0) {
-			// Protect against pathological growth without CRLF
-			if (_rbuf.size() > CHUNK_LINE_MAX && _rbuf.find("\r\n") == std::string::npos) {
-				returnHttpResponse(HttpStatusCode::BadRequest);
-				return true;
-			}
-			std::string::size_type crlf = _rbuf.find("\r\n");
-			if (crlf == std::string::npos) {
-				// need more data
+		if (_chunkRemaining == -1) {
+			size_t crlf = scan_crlf(_rbuf.data(), _rbuf.size());
+			if (crlf == _rbuf.size()) {
+				// Protect against pathological growth without CRLF
+				if (_rbuf.size() > CHUNK_LINE_MAX) returnHttpResponse(HttpStatusCode::BadRequest);
+				// else need more data
 				return true;
 			}
 			std::string line = _rbuf.substr(0, crlf);
@@ -484,22 +766,19 @@ bool Connection::processChunkedBuffered() {
 			continue;
 		}
 
-		// We have a chunk length; wait for data + trailing CRLF
-		if ((long)_rbuf.size() < _chunkRemaining + 2) {
-			// not enough yet
-			return true;
+		// Chunk data: pass on what has arrived instead of waiting for the whole chunk
+		if (_chunkRemaining > 0) {
+			if (_rbuf.empty()) return true;
+			size_t take = (_rbuf.size() < (size_t)_chunkRemaining) ? _rbuf.size() : (size_t)_chunkRemaining;
+			if (!appendBody(_rbuf.data(), take)) return true;
+			_rbuf.erase(0, take);
+			_chunkRemaining -= static_cast<long>(take);
+			if (_chunkRemaining > 0) return true;
+			_chunkRemaining = -2;
 		}
-		// Enforce body size limit pre-append
-		if (_bodyLimit >= 0 && (long)(_bodyBuf.size() + _chunkRemaining) > _bodyLimit) {
-			enableDrain();
-			returnHttpResponse(HttpStatusCode::ContentTooLarge);
-			return true;
-		}
-		// Append chunk data
-		_bodyBuf.append(_rbuf.data(), (size_t)_chunkRemaining);
-		_rbuf.erase(0, (size_t)_chunkRemaining);
-		// Verify CRLF
-		if (!(_rbuf.size() >= 2 && _rbuf[0] == '\r' && _rbuf[1] == '\n')) {
+		// Verify the CRLF closing the chunk data
+		if (_rbuf.size() < 2) return true;
+		if (!(_rbuf[0] == '\r' && _rbuf[1] == '\n')) {
 			returnHttpResponse(HttpStatusCode::BadRequest);
 			return true;
 		}
@@ -509,212 +788,55 @@ bool Connection::processChunkedBuffered() {
 	}
 }
 
-bool	Connection::saveMultipart(const std::string &content_type, std::string &outName, std::string &err, bool &existed) {
-	std::string::size_type	bpos = content_type.find("boundary=");
-	if (bpos == std::string::npos) {
-		err = "no boundary";
-		return false;
-	}
-	std::string	boundary = content_type.substr(bpos + 9);
-	if (!boundary.empty() && boundary[0] == '"') {
-		if (boundary.size() >= 2 && boundary[boundary.size() - 1] == '"')
-			boundary = boundary.substr(1, boundary.size() - 2);
-	}
-	if (boundary.empty()) {
-		err = "empty boundary";
-		return false;
-	}
-	std::string	bmark = std::string("--") + boundary;
-	std::string::size_type pos = 0;
-	for (;;) {
-		std::string::size_type part_start = _bodyBuf.find(bmark, pos);
-		if (part_start == std::string::npos) break;
-		part_start += bmark.size();
-		if (part_start + 2 <= _bodyBuf.size() && _bodyBuf[part_start] == '\r' && _bodyBuf[part_start + 1] == '\n') part_start += 2;
-		std::string::size_type headers_end = _bodyBuf.find("\r\n\r\n", part_start);
-		if (headers_end == std::string::npos) break;
-		std::string headers = _bodyBuf.substr(part_start, headers_end - part_start);
-		std::string::size_type content_start = headers_end + 4;
-
-		std::string::size_type next_b = _bodyBuf.find("\r\n" + bmark, content_start);
-		if (next_b == std::string::npos) {
-			next_b = _bodyBuf.find(bmark, content_start);
-			if (next_b == std::string::npos) next_b = _bodyBuf.size();
-		}
-
-		std::string::size_type cdpos = headers.find("Content-Disposition:");
-		if (cdpos == std::string::npos) {
-			pos = next_b;
-			continue;
-		}
-		std::string::size_type fnpos = headers.find("filename=");
-		if (fnpos == std::string::npos) {
-			pos = next_b;
-			continue;
-		}
-		std::string::size_type qstart = headers.find('"', fnpos);
-		std::string::size_type qend = std::string::npos;
-		if (qstart != std::string::npos) {
-			qend = headers.find('"', qstart + 1);
-		}
-		std::string filename;
-		if (qstart != std::string::npos && qend != std::string::npos && qend > qstart) {
-			filename = headers.substr(qstart + 1, qend - (qstart + 1));
-		} else {
-			std::string::size_type p = headers.find(';', fnpos);
-			if (p == std::string::npos) p = headers.size();
-			std::string tok = headers.substr(fnpos + 9, p - (fnpos + 9));
-			size_t b = 0;
-			while (b < tok.size() && (tok[b] == ' ' || tok[b] == '\t')) ++b;
-			size_t e = tok.size();
-			while (e > b && (tok[e - 1] == ' ' || tok[e - 1] == '\t')) --e;
-			filename = tok.substr(b, e - b);
-		}
-
-		if (filename.empty()) {
-			pos = next_b;
-			continue;
-		}
-
-		std::string content;
-		if (next_b > content_start) content = _bodyBuf.substr(content_start, next_b - content_start);
-		if (content.size() >= 2 && content[content.size() - 2] == '\r' && content[content.size() - 1] == '\n')
-			content.erase(content.size() - 2);
-
-		std::string safe;
-		safe.reserve(filename.size());
-		for (size_t i = 0; i < filename.size(); i++) {
-			char c = filename[i];
-			bool ok = (std::isalnum(c) || c == '.' || c == '_' || c == '-');
-			safe.push_back(ok ? c : '_');
-		}
-		if (safe.empty()) safe = "upload.bin";
-
-		std::string fullpath = _uploadStore;
-		if (!fullpath.empty() && fullpath[fullpath.size()-1] != '/') fullpath += "/";
-		fullpath += safe;
-
-		struct stat	pst;
-		if (::stat(fullpath.c_str(), &pst) == 0) existed = S_ISREG(pst.st_mode);
-
-		FILE *f = std::fopen(fullpath.c_str(), "wb");
-		if (!f) {
-			err = std::string("fopen failed: ") + std::strerror(errno);
-			return false;
-		}
-		size_t wrote = 0;
-		if (!content.empty())
-			wrote = std::fwrite(content.data(), 1, content.size(), f);
-		std::fclose(f);
-		if (wrote != content.size()) {
-			err = "write failed";
-			return false;
-		}
-		outName = safe;
-		return true;
-	}
-	err = "no file part found";
-	return false;
-}
-
 int	Connection::uploadAndRespond() {
+	_bodyState = BODY_DONE;
 	if (_cgiEnabled) {
-		startCgiCurrent();
+		// Started at the headers for a fixed-length body: just finish its stdin
+		if (_cgiState == CGI_NONE) startCgiCurrent();
+		else feedCgiInput();
 		return 1;
 	}
-	// Body complete → if upload_store is configured, write to disk; else simple 200 placeholder
-	if (!_uploadStore.empty()) {
-		std::string	ctype = find_header_icase(_req.headers, "Content-Type");
-		std::string	name;
-		bool	multi = false;
+	// Body complete → if upload_store is configured, move the files into place; else simple 200 placeholder
+	if (!_plan->uploadStore.empty()) {
+		std::string	base = _plan->path;
+		if (base.empty()) base = "/";
+		if (base[base.size() - 1] != '/') base += "/";
+		std::string	url;
+		std::ostringstream	body;
 		bool	existed = false;
-		if (!ctype.empty() && to_lower_copy(ctype).find("multipart/form-data") != std::string::npos) {
+		if (_multipart.active()) {
 			std::string	err;
-			if (saveMultipart(ctype, name, err, existed)) {
-				multi = true;
-			}
-			else {
-				LOG_WARNF("multipart save failed: %s", err.c_str());
-				returnHttpResponse(HttpStatusCode::InternalServerError);
+			bool	bad = false;
+			if (!_multipart.finish(&err, &bad)) {
+				LOG_WARNF("multipart upload failed: %s", err.c_str());
+				returnHttpResponse(bad ? HttpStatusCode::BadRequest : HttpStatusCode::InternalServerError);
 				return 1;
 			}
-		}
-		if (!multi) {
-			std::string target = normalize_target_simple(_req.target);
-			std::string suffix;
-			if (!_matchedLocPath.empty() && target.size() >= _matchedLocPath.size() && target.compare(0, _matchedLocPath.size(), _matchedLocPath) == 0) {
-				suffix = target.substr(_matchedLocPath.size());
-			} else {
-				suffix = target;
-			}
-			name = base_name_only(suffix);
-			if (name.empty() || (!suffix.empty() && suffix[suffix.size()-1] == '/')) {
-				name = gen_unique_upload_name();
-			} else {
-				name = safe_filename(name);
+			const std::vector<MultipartUpload::File> &files = _multipart.files();
+			for (size_t i = 0; i < files.size(); ++i) {
+				body << "Uploaded " << files[i].size << " bytes to " << base << files[i].name
+					 << (files[i].existed ? " (overwritten)" : "") << "\n";
+				existed = existed || files[i].existed;
 			}
-			std::string full = join_path_relative(_uploadStore, name);
-			struct stat st;
-			if (::stat(full.c_str(), &st) == 0)
-				existed = S_ISREG(st.st_mode);
-			FILE *f = std::fopen(full.c_str(), "wb");
-			if (!f) {
-				returnHttpResponse(HttpStatusCode::InternalServerError);
-				return 1;
-			}
-			size_t total = 0;
-			const char *p = _bodyBuf.data();
-			size_t left = _bodyBuf.size();
-			while (left > 0) {
-				size_t w = std::fwrite(p + total, 1, left, f);
-				if (w == 0) break;
-				total += w;
-				left -= w;
-			}
-			std::fclose(f);
-			if (total != _bodyBuf.size()) {
+			url = base + files[0].name;
+		} else {
+			if (!finishUpload(existed)) {
 				returnHttpResponse(HttpStatusCode::InternalServerError);
 				return 1;
 			}
-			// Build Location URL under the matched location path
-			std::string url = _matchedLocPath;
-			if (url.empty()) url = "/";
-			if (url[url.size()-1] != '/') url += "/";
-			url += name;
-			if (existed) {
-				std::ostringstream body;
-				body << "Uploaded " << total << " bytes to " << url << " (overwritten)\n";
-				returnOKResponse(body.str(), "text/plain; charset=utf-8");
-				return 1;
-			} else {
-				returnCreatedResponse(url, total);
-				return 1;
-			}
-		}
-		else {
-			std::string	full = join_path_relative(_uploadStore, name);
-			std::string	url = _matchedLocPath;
-			if (url.empty()) url = "/";
-			if (url[url.size() - 1] != '/') url += "/";
-			url += name;
-			long	sizeBytes = 0;
-			struct stat	st;
-			if (::stat(full.c_str(), &st) == 0) sizeBytes = static_cast<long>(st.st_size);
-			if (existed) {
-				std::ostringstream	body;
-				body << "Uploaded " << sizeBytes << " bytes to " << url << " (overwritten)\n";
-				returnOKResponse(body.str(), "text/plain; charset=utf-8");
-				return 1;
-			}
-			else {
-				returnCreatedResponse(url, sizeBytes);
-				return 1;
-			}
+			url = base + _uploadName;
+			body << "Uploaded " << _bodyReceived << " bytes to " << url << (existed ? " (overwritten)" : "") << "\n";
 		}
+		// Created unless an existing file was replaced
+		if (existed)
+			returnOKResponse(body.str(), "text/plain; charset=utf-8");
+		else
+			returnCreatedResponse(url, body.str());
+		return 1;
 	} else {
 		LOG_WARNF("post complete: upload_store is empty — returning placeholder 200 (no file write)");
 		std::ostringstream body;
-		body << "Received " << _bodyBuf.size() << " bytes\n";
+		body << "Received " << _bodyReceived << " bytes\n";
 		returnOKResponse(body.str(), "text/plain; charset=utf-8");
 		return 1;
 	}
@@ -722,22 +844,131 @@ int	Connection::uploadAndRespond() {
 
 int	Connection::handleFixedBodyChunk(const char *buf, ssize_t n) {
 	size_t take = (n > _clRemaining) ? static_cast<size_t>(_clRemaining) : static_cast<size_t>(n);
-	if (_bodyLimit >= 0 && (long)(_bodyBuf.size() + take) > _bodyLimit) {
-		enableDrain();
-		returnHttpResponse(HttpStatusCode::ContentTooLarge);
-		return 1;
-	}
-	_bodyBuf.append(buf, take);
+	if (!appendBody(buf, take)) return 1;
 	_clRemaining -= static_cast<long>(take);
+	if (take < (size_t)n) _rbuf.append(buf + take, (size_t)n - take); // next pipelined request
 	if (_clRemaining == 0) {
 		return uploadAndRespond();
 	}
 	return 0;
 }
 
+// File name a raw upload is stored under: the last path segment after the
+// location prefix, or a generated one for a bare directory target
+std::string	Connection::uploadTargetName() const {
+	std::string suffix = location_suffix(normalize_target_simple(_req.target), _plan->path);
+	std::string name = base_name_only(suffix);
+	if (name.empty() || (!suffix.empty() && suffix[suffix.size()-1] == '/'))
+		return gen_unique_upload_name();
+	return safe_filename(name);
+}
+
+// For an upload, open a temp file next to the destination so the final
+// rename stays on one filesystem and never exposes a partial file under its
+// real name (multipart bodies: one per file part, as they arrive). CGI
+// bodies stay in memory. Returns false after queuing an error response.
+bool	Connection::beginUpload() {
+	if (_cgiEnabled || _plan->uploadStore.empty()) return true;
+	std::string ctype = _req.headers.get(HttpHeaders::H_CONTENT_TYPE);
+	if (to_lower_copy(ctype).find("multipart/form-data") != std::string::npos) {
+		std::string err;
+		if (_multipart.begin(_plan->uploadStore, ctype, &err)) return true;
+		LOG_WARNF("multipart upload: %s", err.c_str());
+		enableDrain();
+		returnHttpResponse(HttpStatusCode::BadRequest);
+		return false;
+	}
+	_uploadName = uploadTargetName();
+	_uploadFd = open_upload_temp(_plan->uploadStore, _uploadTmp);
+	if (_uploadFd != -1) return true;
+	LOG_WARNF("upload: cannot create temp file in %s: %s", _plan->uploadStore.c_str(), std::strerror(errno));
+	enableDrain();
+	returnHttpResponse(HttpStatusCode::InternalServerError);
+	return false;
+}
+
+bool	Connection::finishUpload(bool &existed) {
+	int fd = _uploadFd;
+	_uploadFd = -1;
+	if (fd == -1 || ::close(fd) != 0) {
+		discardUpload();
+		return false;
+	}
+	std::string full = join_path_relative(_plan->uploadStore, _uploadName);
+	struct stat st;
+	if (::stat(full.c_str(), &st) == 0)
+		existed = S_ISREG(st.st_mode);
+	if (::rename(_uploadTmp.c_str(), full.c_str()) != 0) {
+		LOG_WARNF("upload: rename to %s failed: %s", full.c_str(), std::strerror(errno));
+		discardUpload();
+		return false;
+	}
+	_uploadTmp.clear();
+	return true;
+}
+
+void	Connection::discardUpload() {
+	_multipart.abort();
+	if (_uploadFd != -1) {
+		::close(_uploadFd);
+		_uploadFd = -1;
+	}
+	if (!_uploadTmp.empty()) {
+		(void)::unlink(_uploadTmp.c_str());
+		_uploadTmp.clear();
+	}
+}
+
+// Take body bytes: into a running CGI, the multipart receiver or the upload
+// temp file, otherwise into _bodyBuf (chunked CGI input, placeholder POST).
+// Enforces the body size limit.
+bool	Connection::appendBody(const char *data, size_t len) {
+	if (_bodyLimit >= 0 && _bodyReceived + (long)len > _bodyLimit) {
+		enableDrain();
+		returnHttpResponse(HttpStatusCode::ContentTooLarge);
+		return false;
+	}
+	_bodyReceived += (long)len;
+	if (_cgiState != CGI_NONE) {
+		// Running CGI: on to its stdin (dropped if it stopped reading)
+		if (_cgiIn != -1) {
+			_bodyBuf.append(data, len);
+			feedCgiInput();
+		}
+		return true;
+	}
+	if (_multipart.active()) {
+		std::string err;
+		bool bad = false;
+		if (_multipart.feed(data, len, &err, &bad)) return true;
+		LOG_WARNF("multipart upload failed: %s", err.c_str());
+		enableDrain();
+		returnHttpResponse(bad ? HttpStatusCode::BadRequest : HttpStatusCode::InternalServerError);
+		return false;
+	}
+	if (_uploadFd == -1) {
+		_bodyBuf.append(data, len);
+		return true;
+	}
+	while (len > 0) {
+		ssize_t w = ::write(_uploadFd, data, len);
+		if (w < 0 && errno == EINTR) continue;
+		if (w <= 0) {
+			LOG_WARNF("upload: write to %s failed: %s", _uploadTmp.c_str(), w < 0 ? std::strerror(errno) : "no progress");
+			discardUpload();
+			enableDrain();
+			returnHttpResponse(HttpStatusCode::InternalServerError);
+			return false;
+		}
+		data += w;
+		len -= (size_t)w;
+	}
+	return true;
+}
+
 void	Connection::selectVhost(const HttpRequest &req) {
 	// Vhost selection based on Host header (case-insensitive, strip port)
-	std::string host = find_header_icase(req.headers, "Host");
+	std::string host = req.headers.get(HttpHeaders::H_HOST);
 	if (!host.empty()) {
 		std::string name = to_lower_copy(strip_port(host));
 		for (size_t i = 0; i < _group.size(); ++i) {
@@ -747,8 +978,6 @@ void	Connection::selectVhost(const HttpRequest &req) {
 				if (to_lower_copy(sc->getServerName()[j]) == name) {
 					if (sc != _srv) {
 						_srv = sc;
-						_root = _srv->getRoot();
-						_index = _srv->getIndex();
 						_vhostName = sc->getServerName()[j];
 					}
 					return;
@@ -760,18 +989,12 @@ void	Connection::selectVhost(const HttpRequest &req) {
 
 bool	Connection::deleteMethod(const std::string &effRoot, const HttpRequest &req) {
 	// Determine base directory for deletion
-	std::string base = !_uploadStore.empty() ? _uploadStore : effRoot;
+	std::string base = !_plan->uploadStore.empty() ? _plan->uploadStore : effRoot;
 	if (base.empty()) {
 		returnHttpResponse(HttpStatusCode::NotFound);
 		return true;
 	}
-	std::string target = normalize_target_simple(req.target);
-	std::string suffix;
-	if (!_matchedLocPath.empty() && target.size() >= _matchedLocPath.size() && target.compare(0, _matchedLocPath.size(), _matchedLocPath) == 0) {
-		suffix = target.substr(_matchedLocPath.size());
-	} else {
-		suffix = target;
-	}
+	std::string suffix = location_suffix(normalize_target_simple(req.target), _plan->path);
 	std::string name = base_name_only(suffix);
 	if (name.empty()) {
 		returnHttpResponse(HttpStatusCode::NotFound);
@@ -787,11 +1010,11 @@ bool	Connection::deleteMethod(const std::string &effRoot, const HttpRequest &req
 	}
 
 	std::string full;
-	if (!_uploadStore.empty()) {
+	if (!_plan->uploadStore.empty()) {
 		full = join_path_relative(base, name);
 	}
 	else {
-		std::string	rel = _matchedLocPath;
+		std::string	rel = _plan->path;
 		if (!rel.empty() && rel[0] == '/') rel.erase(0, 1);
 		if (!suffix.empty() && suffix[0] == '/') suffix.erase(0, 1);
 		if (!rel.empty() && rel[rel.size() - 1] != '/') rel += '/';
@@ -809,7 +1032,7 @@ bool	Connection::deleteMethod(const std::string &effRoot, const HttpRequest &req
 	}
 
 	if (::unlink(full.c_str()) == 0) {
-		if (req.method == "DELETE")
+		if (req.methodId == METHOD_DELETE)
 			returnHttpResponse(HttpStatusCode::NoContent);
 		else {
 			std::string	rel = req.target;
@@ -828,74 +1051,76 @@ bool	Connection::deleteMethod(const std::string &effRoot, const HttpRequest &req
 	return true;
 }
 
-bool	Connection::getMethod(const HttpRequest &req, const Location *loc, std::string &effRoot,
-							  std::vector<std::string> &effIndex, bool isHead, bool effAutoindex) {
+bool	Connection::getMethod(const HttpRequest &req, const Location *loc, const LocationPlan &plan, bool isHead) {
 	HttpResponse resp;
 	std::string err;
+	const std::vector<std::string> &effIndex = plan.index;
+	const bool effAutoindex = plan.autoindex;
+	const std::string *effRoot = &plan.root;
+	std::string fallbackRoot;
 	// If a location overrides root, strip the matched prefix from the URL before resolving
-	HttpRequest adj = req;
-	if (loc && !loc->getPath().empty() && !effAutoindex) {
-		std::string norm = normalize_target_simple(req.target);
-		std::string	lpath = loc->getPath();
-		if (!lpath.empty() && lpath[lpath.size() - 1] != '/')
-			lpath += '/';
-		if (norm.size() >= lpath.size() && norm.compare(0, lpath.size(), lpath) == 0) {
-			std::string suffix = norm.substr(lpath.size());
-			if (suffix.empty()) suffix = "/";
-			if (suffix[0] != '/') suffix = std::string("/") + suffix;
-			adj.target = suffix;
-			LOG_INFOF("static resolve: stripped prefix '%s' → '%s' under root '%s'", lpath.c_str(), adj.target.c_str(), effRoot.c_str());
-		}
+	std::string target;
+	std::string::size_type strip = std::string::npos;
+	if (!plan.path.empty() && !effAutoindex) strip = prefix_end(req.target, plan.path);
+	if (strip != std::string::npos) {
+		target = "/" + req.target.substr(strip);
+		LOG_INFOF("static resolve: stripped prefix '%s' → '%s' under root '%s'", plan.path.c_str(), target.c_str(), effRoot->c_str());
+	} else {
+		target = req.target;
 	}
 
 	bool	download = false;
 	if (req.target.find("__download") != std::string::npos) {
 		download = true;
-		std::string::size_type	q = adj.target.find('?');
-		if (q != std::string::npos) adj.target.erase(q);
+		std::string::size_type	q = target.find('?');
+		if (q != std::string::npos) target.erase(q);
 	}
 
-	std::string	validIndex;
-	for (size_t i = 0; i < effIndex.size(); i++) {
-		std::string idx = join_path_relative(effRoot, effIndex[i]);
-		bool isDir = false;
-		if (file_exists(idx, &isDir) && !isDir) {
-			validIndex = idx;
-			break;
+	// No root at all: resolve against the directory of the first index file
+	// that exists
+	if (effRoot->empty()) {
+		std::string	validIndex;
+		for (size_t i = 0; i < effIndex.size(); i++) {
+			std::string idx = join_path_relative(*effRoot, effIndex[i]);
+			bool isDir = false;
+			if (file_exists(idx, &isDir) && !isDir) {
+				validIndex = idx;
+				break;
+			}
 		}
-	}
-	if (effRoot.empty() && !validIndex.empty()) {
-		std::string	path = join_path_relative(effRoot, adj.target);
+		std::string	path = join_path_relative(*effRoot, target);
 		bool	isDir = false;
-		if (!file_exists(path, &isDir) && !isDir) {
+		if (!validIndex.empty() && !file_exists(path, &isDir) && !isDir) {
 			std::string::size_type	pos = validIndex.find_last_of('/');
 			std::string	tmpRoot;
 			if (pos == std::string::npos)
-				tmpRoot = effRoot;
+				tmpRoot = *effRoot;
 			else if (pos == 0)
 				tmpRoot = std::string("/");
 			else
 				tmpRoot = validIndex.substr(0, pos);
-			path = join_path_relative(tmpRoot, adj.target);
-			if (file_exists(path, &isDir) && !isDir)
-				effRoot = tmpRoot;
+			path = join_path_relative(tmpRoot, target);
+			if (file_exists(path, &isDir) && !isDir) {
+				fallbackRoot = tmpRoot;
+				effRoot = &fallbackRoot;
+			}
 		}
 	}
-	if (handle(effRoot, effIndex, adj, isHead, effAutoindex, resp, loc, err)) {
+	if (handle(*effRoot, effIndex, target, isHead, effAutoindex, resp, loc, err)) {
 		if (download) {
-			std::string	file = adj.target;
+			std::string	file = target;
 			std::string::size_type	p = file.find_last_of('/');
 			if (p != std::string::npos) file = file.substr(p + 1);
 			if (file.empty()) file = "download";
-			if (adj.target.empty() || adj.target[adj.target.size() - 1] != '/') {
+			if (target.empty() || target[target.size() - 1] != '/') {
 				std::ostringstream	cd;
 				cd << "attachment; filename=\"" << file << "\"";
 				resp.setHeader("Content-Disposition", cd.str());
 			}
 		}
-		_wbuf = resp.serialize();
+		appendResponse(resp);
 		_status_code = 200;
-		_t_write_start = now_ms();
+		markWriteStart();
 	} else {
 		// Treat unexpected read/autoindex generation failures as 500; missing files as 404
 		if (err.find("read error:") == 0 || err == "autoindex generation failed") {
@@ -910,28 +1135,26 @@ bool	Connection::getMethod(const HttpRequest &req, const Location *loc, std::str
 }
 
 int	Connection::postMethod(const HttpRequest &req, const long effectiveLimit) {
-	std::string te = find_header_icase(req.headers, "Transfer-Encoding");
+	std::string te = req.headers.get(HttpHeaders::H_TRANSFER_ENCODING);
 	if (!te.empty() && to_lower_copy(te).find("chunked") != std::string::npos) {
 		_bodyLimit = effectiveLimit;
 		_bodyState = BODY_CHUNKED;
 		_chunkRemaining = -1; // expect size line first
 		_chunkReadingTrailers = false;
 		_bodyBuf.clear();
+		if (!beginUpload()) return 1;
 		// Consume any already‑read bytes after headers into _rbuf and process
 		std::string pref2;
 		_parser.takeRemaining(pref2);
 		if (!pref2.empty()) {
 			_rbuf.append(pref2);
 			if (!processChunkedBuffered()) return -1;
-			if (!_wbuf.empty()) {
-				_t_write_start = now_ms();
-				return 1;
-			}
+			if (responseStarted()) return 1;
 		}
 		// Continue reading more chunked data
 		return 0;
 	}
-	std::string clh = find_header_icase(req.headers, "Content-Length");
+	std::string clh = req.headers.get(HttpHeaders::H_CONTENT_LENGTH);
 	if (clh.empty()) {
 		returnHttpResponse(HttpStatusCode::LengthRequired);
 		return 1;
@@ -951,19 +1174,21 @@ int	Connection::postMethod(const HttpRequest &req, const long effectiveLimit) {
 	_bodyState = BODY_FIXED;
 	_clRemaining = cl;
 	_bodyBuf.clear();
+	if (!beginUpload()) return 1;
+	// CGI with a known length starts now and gets the body as it arrives
+	if (_cgiEnabled && _clRemaining > 0) {
+		startCgiCurrent();
+		if (_status_code != 0) return 1;
+	}
 	// Consume any bytes already buffered after headers
 	std::string pref;
 	_parser.takeRemaining(pref);
 	if (!pref.empty()) {
 		size_t take = (pref.size() > (size_t)_clRemaining) ? (size_t)_clRemaining : pref.size();
-		if (_bodyLimit >= 0 && (long)(_bodyBuf.size() + take) > _bodyLimit) {
-			enableDrain();
-			returnHttpResponse(HttpStatusCode::ContentTooLarge);
-			return 1;
-		}
-		_bodyBuf.append(pref.data(), take);
+		if (!appendBody(pref.data(), take)) return 1;
 		_clRemaining -= static_cast<long>(take);
-		// ignore any extra bytes beyond Content-Length (no pipelining support in v0)
+		// Bytes past Content-Length start the next pipelined request
+		_rbuf.append(pref, take, std::string::npos);
 	}
 	if (_clRemaining == 0) {
 		return uploadAndRespond();
@@ -986,179 +1211,304 @@ bool Connection::onReadable() {
 			break;
 		}
 		_t_last_active = now_ms();
+		if (_idle) {
+			// First bytes of the next request on a kept-alive connection
+			_idle = false;
+			_t_start = _t_last_active;
+			_t_headers_start = _t_last_active;
+		}
 
 		if (_drainAfterResponse) continue;
 
-		// If we are in body reading mode, bypass header parser entirely
-		if (_headersDone && _bodyState == BODY_FIXED && _clRemaining > 0) {
-			int	hr = handleFixedBodyChunk(buf, n);
-			if (hr == 1) return true;
-			if (hr == -1) return false;
-			// If peer sent more than Content-Length, ignore the extra bytes for now
-			continue;
-		}
+		if (consumeInput(buf, static_cast<size_t>(n)) == -1) return false;
+		if (!advance()) return false;
+		// Busy with a response, or enough of them queued: leave the rest in the socket
+		if (!wantRead()) return true;
+	}
+	return true;
+}
+
+int Connection::consumeInput(const char *buf, size_t n) {
+	// If we are in body reading mode, bypass header parser entirely
+	if (_headersDone && _bodyState == BODY_FIXED && _clRemaining > 0) {
+		return handleFixedBodyChunk(buf, n);
+	}
+
+	// If reading chunked body, accumulate and process
+	if (_headersDone && _bodyState == BODY_CHUNKED) {
+		_rbuf.append(buf, n);
+		if (!processChunkedBuffered()) return -1; // closed
+		// If a response was generated, return to write
+		return responseStarted() ? 1 : 0;
+	}
 
-		// If reading chunked body, accumulate and process
-		if (_headersDone && _bodyState == BODY_CHUNKED) {
-			_rbuf.append(buf, n);
-			if (!processChunkedBuffered()) return false; // closed
-			// If a response was generated, return to write
-			if (!_wbuf.empty()) return true;
-			continue; // read more
+	// Otherwise, feed the header parser
+	HttpParser::Result r = _parser.feed(buf, n);
+	if (r == HttpParser::ERROR) {
+		// Classify parse error to appropriate status
+		HttpParser::ErrorKind ek = _parser.errorKind();
+		if (ek == HttpParser::ERR_REQUEST_LINE_TOO_LONG) {
+			returnHttpResponse(HttpStatusCode::URITooLong);
+		} else if (ek == HttpParser::ERR_HEADER_LINE_TOO_LONG || ek == HttpParser::ERR_TOO_MANY_HEADERS) {
+			returnHttpResponse(HttpStatusCode::RequestHeaderFieldsTooLarge);
+		} else {
+			returnHttpResponse(HttpStatusCode::BadRequest);
+		}
+		return 1; // switch to write
+	}
+	if (r == HttpParser::OK) {
+		// Snapshot request and mark headers done
+		_req = _parser.request();
+		const HttpRequest &req = _req;
+		_headersDone = true;
+		_reqLine = req.method + std::string(" ") + req.target + std::string(" ") + req.version;
+		selectVhost(req);
+		decideKeepAlive(req);
+
+		// A second Host, or Content-Lengths that disagree, leave the target or
+		// the framing ambiguous (RFC 9112 3.2, 6.3)
+		if (req.headers.count(HttpHeaders::H_HOST) > 1 || !content_lengths_agree(req.headers)) {
+			_keepAlive = false;
+			returnHttpResponse(HttpStatusCode::BadRequest);
+			return 1;
 		}
 
-		// Otherwise, feed the header parser
-		HttpParser::Result r = _parser.feed(buf, static_cast<size_t>(n));
-		if (r == HttpParser::ERROR) {
-			// Classify parse error to appropriate status
-			HttpParser::ErrorKind ek = _parser.errorKind();
-			if (ek == HttpParser::ERR_REQUEST_LINE_TOO_LONG) {
-				returnHttpResponse(HttpStatusCode::URITooLong);
-			} else if (ek == HttpParser::ERR_HEADER_LINE_TOO_LONG || ek == HttpParser::ERR_TOO_MANY_HEADERS) {
-				returnHttpResponse(HttpStatusCode::RequestHeaderFieldsTooLarge);
-			} else {
-				returnHttpResponse(HttpStatusCode::BadRequest);
-			}
-			return true; // switch to write
+		// Match location
+		RouteMatch match = _srv ? _srv->route(req.target) : RouteMatch();
+		const Location *loc = match.loc;
+		if (loc) _plan = &loc->getPlan();
+		else if (_srv) _plan = &_srv->getDefaultPlan();
+		const LocationPlan &plan = *_plan;
+
+		// Redirect takes precedence if configured
+		if (loc && loc->hasReturnDir()) {
+			returnHttpResponse(loc->getReturnDir());
+			return 1;
 		}
-		if (r == HttpParser::OK) {
-			// Snapshot request and mark headers done
-			_req = _parser.request();
-			const HttpRequest &req = _req;
-			_headersDone = true;
-			_reqLine = req.method + std::string(" ") + req.target + std::string(" ") + req.version;
-			selectVhost(req);
-
-			// (Re)build router if server changed
-			if (_srv && _routerSrv != _srv) { _router.build(*_srv); _routerSrv = _srv; }
-
-			// Match location
-			RouteMatch match = _router.match(req.target);
-			const Location *loc = match.loc;
-			_matchedLocPath = loc ? loc->getPath() : std::string();
-
-			// Redirect takes precedence if configured
-			if (loc && loc->hasReturnDir()) {
-				returnHttpResponse(loc->getReturnDir());
-				return true;
-			}
 
-			bool isHead = (req.method == "HEAD");
-			bool isGet = (req.method == "GET");
-			bool isPost = (req.method == "POST");
-			bool isDelete = (req.method == "DELETE");
-
-			// Method filtering
-			if (loc && !loc->getAllowedMethods().empty()) {
-				bool	getAllowed = loc->findMethod("GET") != std::string::npos;
-				bool	postAllowed = loc->findMethod("POST") != std::string::npos;
-				bool	deleteAllowed = loc->findMethod("DELETE") != std::string::npos;
-				bool	headAllowed = getAllowed || loc->findMethod("HEAD") != std::string::npos;
-
-				bool	disallowed = ((isGet || isHead) && !getAllowed) || (isPost && !postAllowed) || (isDelete && !deleteAllowed);
-
-				if (disallowed) {
-					std::string	allow;
-					if (getAllowed)
-						allow += "GET, HEAD";
-					else if (headAllowed)
-						allow += "HEAD";
-
-					if (postAllowed) {
-						if (!allow.empty()) allow += ", ";
-						allow += "POST";
-					}
-					if (deleteAllowed) {
-						if (!allow.empty()) allow += ", ";
-						allow += "DELETE";
-					}
+		bool isHead = (req.methodId == METHOD_HEAD);
+		bool isGet = (req.methodId == METHOD_GET);
+		bool isPost = (req.methodId == METHOD_POST);
+		bool isDelete = (req.methodId == METHOD_DELETE);
 
-					if (allow.empty()) allow = "GET, HEAD";
-					returnHttpResponse(HttpStatusCode::MethodNotAllowed, allow);
-					return true;
-				}
-			}
-			// Compute effective root/index/autoindex
-			std::string effRoot = _root;
-			std::vector<std::string> effIndex = _index;
-			bool effAutoindex = false;
-			long effectiveLimit = -1;
-			if (loc) {
-				if (!loc->getRoot().empty()) effRoot = loc->getRoot();
-				if (!loc->getIndex().empty()) effIndex = loc->getIndex();
-				if (loc->getAutoindex()) effAutoindex = loc->getAutoindex();
-				if (loc->getClientMaxBodySize() >= 0) effectiveLimit = (size_t)loc->getClientMaxBodySize();
+		// Method filtering (mask and Allow value are built at config load)
+		if (loc && !loc->allowsMethod(req.methodId)) {
+			returnHttpResponse(HttpStatusCode::MethodNotAllowed, loc->getAllowHeader());
+			return 1;
+		}
+		if (!isGet && !isHead && !isPost && !isDelete) {
+			returnHttpResponse(HttpStatusCode::NotImplemented);
+			return 1;
+		}
+		// Root, index, limits, CGI and upload paths come resolved in the plan
+		_cgiEnabled = plan.cgi;
+		if (_cgiEnabled && !plan.cgiPath.empty()) {
+			_locCgiPath = plan.cgiPath;
+		} else if (_cgiEnabled && plan.cgiByTarget) {
+			// The regex already picked the script: it is the target under root
+			_locCgiPath = join_path_relative(plan.root, sanitize(req.target));
+			bool isDir = false;
+			if (!file_exists(_locCgiPath, &isDir) || isDir) {
+				returnHttpResponse(HttpStatusCode::NotFound);
+				return 1;
 			}
-			if (effectiveLimit < 0 && _srv && _srv->getClientMaxBodySize() > 0) effectiveLimit = (size_t)_srv->getClientMaxBodySize();
-			_cgiEnabled = (loc && !loc->getCgiPass().empty());
-			_locCgiPass = _cgiEnabled ? loc->getCgiPass() : std::string();
-			_locCgiPath = (loc && !loc->getCgiPath().empty()) ? join_path_absolute(effRoot, loc->getCgiPath()) : std::string();
-			_effRootForRequest = effRoot;
-			_uploadStore = (loc && !loc->getUploadStore().empty()) ? join_path_absolute(effRoot, loc->getUploadStore()) : std::string();
-
-			std::string	cgiExt = (loc && !loc->getCgiExt().empty()) ? loc->getCgiExt() : std::string();
-			if (_cgiEnabled && _locCgiPath.empty())
-				_locCgiPath = getFilefromExt(req.target, effRoot, cgiExt);
-
-			if (isGet) {
-				if (loc && loc->findMethod("DELETE") != std::string::npos) {
-					if (req.target.find("__method=DELETE") != std::string::npos) {
-						HttpRequest	adj = req;
-						std::string::size_type	query = adj.target.find('?');
-						if (query != std::string::npos) adj.target.erase(query);
-						return deleteMethod(effRoot, adj);
-					}
+		} else if (_cgiEnabled) {
+			_locCgiPath = getFilefromExt(req.target, plan.root, plan.cgiExt);
+		}
+
+		if (isGet) {
+			if (loc && loc->listsMethod(METHOD_DELETE)) {
+				if (req.target.find("__method=DELETE") != std::string::npos) {
+					HttpRequest	adj = req;
+					std::string::size_type	query = adj.target.find('?');
+					if (query != std::string::npos) adj.target.erase(query);
+					return deleteMethod(plan.root, adj) ? 1 : -1;
 				}
 			}
-			if (isDelete) {
-				return deleteMethod(effRoot, req);
-			}
-			if (_cgiEnabled && isGet) {
-				startCgiCurrent();
-				return true;
-			}
-			if (isGet || isHead) {
-				return getMethod(req, loc, effRoot, effIndex, isHead, effAutoindex);
-			}
-			// POST path — initialize body machine (fixed-length only for now)
-			if (isPost) {
-				int	hr = postMethod(req, effectiveLimit);
-				if (hr == 1) return true;
-				if (hr == -1) return false;
-				continue;
-			}
 		}
-		// NEED_MORE: continue reading loop
+		if (isDelete) {
+			return deleteMethod(plan.root, req) ? 1 : -1;
+		}
+		if (_cgiEnabled && isGet) {
+			startCgiCurrent();
+			return 1;
+		}
+		if (isGet || isHead) {
+			return getMethod(req, loc, plan, isHead) ? 1 : -1;
+		}
+		// POST path — initialize body machine (fixed-length only for now)
+		if (isPost) {
+			return postMethod(req, plan.bodyLimit);
+		}
 	}
-	return true;
+	// NEED_MORE: wait for more bytes
+	return 0;
+}
+
+// Gather the memory blocks at the front of the queue (up to the next file
+// region) into one sendmsg(2), then retire what went out by advancing offsets.
+ssize_t Connection::sendMemorySegments() {
+	struct iovec iov[OUT_IOV_MAX];
+	size_t cnt = 0;
+	for (size_t i = 0; i < _out.size() && cnt < OUT_IOV_MAX && _out[i].fd == -1; ++i) {
+		iov[cnt].iov_base = &_out[i].data[_out[i].consumed];
+		iov[cnt].iov_len = _out[i].data.size() - _out[i].consumed;
+		++cnt;
+	}
+	struct msghdr msg;
+	std::memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = cnt;
+	ssize_t n = ::sendmsg(_fd, &msg, MSG_NOSIGNAL);
+	// n == 0: no progress; n < 0: Subject compliance — do not read errno
+	// after send. Wait for next POLLOUT or timeout.
+	if (n <= 0) return n;
+	size_t left = (size_t)n;
+	_outMem -= left;
+	while (left > 0) {
+		OutSegment &seg = _out.front();
+		size_t unsent = seg.data.size() - seg.consumed;
+		if (left < unsent) {
+			seg.consumed += left;
+			break;
+		}
+		left -= unsent;
+		_out.pop_front();
+	}
+	return n;
+}
+
+// Push part of a file region to the socket. Returns 1 with sent set on
+// progress, 0 when the socket is full, -1 when the file can no longer supply
+// the bytes announced in Content-Length, -2 when the socket failed.
+int Connection::sendFileSegment(OutSegment &seg, size_t &sent) {
+	sent = 0;
+#ifdef __linux__
+	if (!seg.buffered) {
+		ssize_t n = ::sendfile(_fd, seg.fd, &seg.offset, seg.length);
+		if (n > 0) {
+			seg.length -= (size_t)n;
+			sent = (size_t)n;
+			return 1;
+		}
+		if (n == 0) return -1; // file shrank after the head went out
+		if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+		if (errno != EINVAL && errno != ENOSYS) return -2; // EPIPE, ECONNRESET...
+		seg.buffered = true; // e.g. a filesystem without sendfile support
+	}
+#endif
+	// Buffered fallback: a bounded piece per call, unsent bytes are read again
+	char buf[65536];
+	size_t want = (seg.length < sizeof(buf)) ? seg.length : sizeof(buf);
+	ssize_t r = ::pread(seg.fd, buf, want, seg.offset);
+	if (r <= 0) return -1;
+	ssize_t n = ::send(_fd, buf, (size_t)r, MSG_NOSIGNAL);
+	if (n <= 0) return 0;
+	seg.offset += n;
+	seg.length -= (size_t)n;
+	sent = (size_t)n;
+	return 1;
 }
 
 bool Connection::onWritable() {
 	if (_closed) return false;
-	if (_wbuf.empty()) return true;
-	for (;;) {
-		ssize_t n = ::send(_fd, &_wbuf[0], _wbuf.size(), 0);
-		if (n > 0) {
-			_t_last_active = now_ms();
-			_bytes_sent += (size_t)n;
-			_wbuf.erase(_wbuf.begin(), _wbuf.begin() + n);
-			if (_wbuf.empty()) {
-				if (_drainAfterResponse) {
-					if (_t_write_start == 0) _t_write_start = now_ms();
-					return true;
-				}
+	if (_out.empty()) return true;
+	while (!_out.empty()) {
+		OutSegment &seg = _out.front();
+		size_t sent = 0;
+		if (seg.fd == -1) {
+			ssize_t n = sendMemorySegments();
+			if (n <= 0) break;
+			sent = (size_t)n;
+		} else {
+			int r = sendFileSegment(seg, sent);
+			if (r == -2) {
+				LOG_DEBUGF("peer gone during file send on fd=%d, closing", _fd);
 				closeFd();
 				return false;
 			}
-			continue; // try to send more in this readiness
-		}
-		if (n == 0) {
-			// No progress; wait for next POLLOUT
-			return true;
+			if (r < 0) {
+				LOG_WARNF("static file shorter than announced for fd=%d, closing", _fd);
+				closeFd();
+				return false;
+			}
+			if (r == 0) break;
+			if (seg.length == 0) {
+				::close(seg.fd);
+				_out.pop_front();
+			}
 		}
-		// n < 0: Subject compliance — do not read errno after send; wait for next poll()/timeout
+		// The write timeout is about stalls: long downloads keep going
+		_t_last_active = now_ms();
+		_t_write_start = _t_last_active;
+		_sentTotal += sent;
+		if (!retireSent()) return false;
+	}
+	if (_cgiPaused && _outMem < CGI_OUTPUT_LOW) pauseCgiOutput(false);
+	if (!_out.empty()) return true;
+	setCork(false); // flush the last partial frame
+	if (_drainAfterResponse) {
+		if (_t_write_start == 0) markWriteStart();
 		return true;
 	}
+	// Room in the queue again: answer requests that were read ahead
+	return advance();
+}
+
+// Write pending body bytes to the child's stdin without blocking. Written
+// bytes are skipped by offset; stdin is closed once the whole body went in.
+void Connection::feedCgiInput() {
+	if (_cgiIn == -1) return;
+	while (_cgiInOff < _bodyBuf.size()) {
+		ssize_t n = ::write(_cgiIn, _bodyBuf.data() + _cgiInOff, _bodyBuf.size() - _cgiInOff);
+		if (n <= 0) break; // pipe full: wait for POLLOUT
+		_cgiInOff += (size_t)n;
+		_t_cgi_active = now_ms();
+	}
+	if (_cgiInOff == _bodyBuf.size()) {
+		_bodyBuf.clear();
+		_cgiInOff = 0;
+	}
+	if (_bodyBuf.empty() && _bodyState == BODY_DONE) {
+		if (_loop) _loop->unregisterAuxFd(_cgiIn);
+		::close(_cgiIn); _cgiIn = -1;
+	} else if (_loop) {
+		_loop->updateAuxFd(_cgiIn, _bodyBuf.empty() ? 0 : POLLOUT);
+	}
+	// A drained pipe lets the socket be read again
+	interestChanged();
+	armTimer();
+}
+
+// Queue CGI body bytes (as one chunk when relaying chunked) and stop reading
+// the child while the client lets output pile up
+void Connection::appendCgiBody(const char *data, size_t len) {
+	if (len == 0) return;
+	if (_cgiChunked) {
+		char size[24];
+		int w = std::snprintf(size, sizeof(size), "%lx\r\n", (unsigned long)len);
+		appendOutput(size, (size_t)w);
+		appendOutput(data, len);
+		appendOutput("\r\n", 2);
+	} else {
+		appendOutput(data, len);
+	}
+	_cgiOutputSent += len;
+	if (_outMem >= CGI_OUTPUT_HIGH) pauseCgiOutput(true);
+}
+
+// Backpressure on the child's stdout. The fd leaves the poller rather than
+// keeping an empty interest, which would still report POLLHUP once it exits.
+void Connection::pauseCgiOutput(bool pause) {
+	if (pause == _cgiPaused || _cgiOut == -1 || !_loop) return;
+	if (pause) {
+		_loop->unregisterAuxFd(_cgiOut);
+	} else {
+		_loop->registerAuxFd(_cgiOut, this, POLLIN);
+		_t_cgi_active = now_ms();
+	}
+	_cgiPaused = pause;
+	armTimer();
 }
 
 bool Connection::startCgiWith(const std::string &cgiPass, const std::string &cgiPath,
@@ -1177,7 +1527,8 @@ bool Connection::startCgiWith(const std::string &cgiPass, const std::string &cgi
 	}
 
 	if (pid == 0) {
-		// Child
+		// Child; ignored signals survive execve, and scripts expect SIGPIPE
+		::signal(SIGPIPE, SIG_DFL);
 		::dup2(inpipe[0], STDIN_FILENO);
 		::dup2(outpipe[1], STDOUT_FILENO);
 		::close(inpipe[0]); ::close(inpipe[1]);
@@ -1195,19 +1546,17 @@ bool Connection::startCgiWith(const std::string &cgiPass, const std::string &cgi
 		envv.push_back(std::string("SERVER_PORT=") + port);
 		std::string target = _req.target; std::string::size_type q = target.find('?'); std::string qs = (q == std::string::npos) ? std::string("") : target.substr(q + 1);
 		envv.push_back(std::string("QUERY_STRING=") + qs);
-		std::string ct = find_header_icase(req.headers, "Content-Type");
+		std::string ct = req.headers.get(HttpHeaders::H_CONTENT_TYPE);
 		if (!ct.empty()) envv.push_back(std::string("CONTENT_TYPE=") + ct);
-		if (!_bodyBuf.empty()) {
-			std::ostringstream cl;
-			cl << _bodyBuf.size();
-			envv.push_back(std::string("CONTENT_LENGTH=") + cl.str());
-		}
-		else {
-			envv.push_back(std::string("CONTENT_LENGTH=0"));
-		}
+		std::ostringstream cl;
+		cl << (_bodyReceived + _clRemaining); // received, or announced and still coming
+		envv.push_back(std::string("CONTENT_LENGTH=") + cl.str());
 		envv.push_back("GATEWAY_INTERFACE=CGI/1.1");
-		for (std::map<std::string,std::string>::const_iterator it = req.headers.begin(); it != req.headers.end(); ++it) {
-			std::string name = it->first; std::string val = it->second;
+		// One variable per name; repeated fields are comma-joined (RFC 3875 4.1.18)
+		for (size_t h = 0; h < req.headers.size(); ++h) {
+			const HttpHeaders::Field &f = req.headers.at(h);
+			if (f.repeat) continue;
+			std::string name = f.name; std::string val = req.headers.joined(h);
 			for (size_t i=0;i<name.size();++i){char &c=name[i]; if (c=='-') c='_'; else if (c>='a'&&c<='z') c = (char)(c - 'a' + 'A');}
 			envv.push_back(std::string("HTTP_") + name + "=" + val);
 		}
@@ -1231,17 +1580,22 @@ bool Connection::startCgiWith(const std::string &cgiPass, const std::string &cgi
 	_cgiPid = pid; _cgiIn = inpipe[1]; _cgiOut = outpipe[0];
 	::close(inpipe[0]); ::close(outpipe[1]);
 
-	// Non-blocking
+	// Non-blocking, and not inherited by later CGI children
 	int fl;
 	fl = fcntl(_cgiIn, F_GETFL, 0); if (fl != -1) fcntl(_cgiIn, F_SETFL, fl | O_NONBLOCK);
 	fl = fcntl(_cgiOut, F_GETFL, 0); if (fl != -1) fcntl(_cgiOut, F_SETFL, fl | O_NONBLOCK);
+	fcntl(_cgiIn, F_SETFD, FD_CLOEXEC);
+	fcntl(_cgiOut, F_SETFD, FD_CLOEXEC);
 
-	_cgiState = CGI_STREAMING; _t_cgi_start = now_ms(); _cgiHeadersDone = false; _cgiStatusFromCGI = 0; _cgiOutputSent = 0; _cgiHdrBuf.clear(); _cgiHdrs.clear();
+	_cgiState = CGI_STREAMING; _t_cgi_active = now_ms(); _cgiHeadersDone = false; _cgiStatusFromCGI = 0; _cgiOutputSent = 0; _cgiChunked = false; _cgiPaused = false; _cgiHdrBuf.clear(); _cgiHdrs.clear();
+	armTimer();
 
 	if (_loop) {
 		_loop->registerAuxFd(_cgiOut, this, POLLIN);
-		if (!_bodyBuf.empty()) {
-			_loop->registerAuxFd(_cgiIn, this, POLLOUT);
+		if (_bodyReceived + _clRemaining > 0) {
+			// Interest follows the bytes waiting for it (see feedCgiInput)
+			_loop->registerAuxFd(_cgiIn, this, 0);
+			feedCgiInput();
 		} else {
 			::close(_cgiIn); _cgiIn = -1;
 		}
@@ -1251,63 +1605,61 @@ bool Connection::startCgiWith(const std::string &cgiPass, const std::string &cgi
 
 bool Connection::onAuxEvent(int fd, short revents) {
 	if (_closed) return false;
+	if (!cgiEvent(fd, revents)) return false;
+	// A finished CGI response lets queued requests proceed
+	return advance();
+}
+
+bool Connection::cgiEvent(int fd, short revents) {
 	const uint64_t tnow = now_ms();
 	if (fd == _cgiIn) {
 		if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			// The child stopped reading: the rest of the body is discarded
 			if (_loop) _loop->unregisterAuxFd(_cgiIn);
-			::close(_cgiIn); _cgiIn = -1; return true;
+			::close(_cgiIn); _cgiIn = -1;
+			_bodyBuf.clear(); _cgiInOff = 0;
+			interestChanged();
+			return true;
 		}
 		if (revents & POLLOUT) {
-			if (!_bodyBuf.empty()) {
-				ssize_t n = ::write(_cgiIn, _bodyBuf.data(), _bodyBuf.size());
-				if (n > 0) {
-					_bodyBuf.erase(0, (size_t)n); _t_last_active = tnow;
-					if (_bodyBuf.empty()) {
-						if (_loop) _loop->unregisterAuxFd(_cgiIn);
-						::close(_cgiIn); _cgiIn = -1;
-					}
-				}
-			} else {
-				if (_loop) _loop->unregisterAuxFd(_cgiIn);
-				::close(_cgiIn); _cgiIn = -1;
-			}
+			feedCgiInput();
+			_t_last_active = tnow;
 		}
 		return true;
 	}
 	if (fd == _cgiOut) {
 		if (revents & (POLLERR | POLLNVAL)) {
-			if (_cgiPid > 0) { (void)::kill(_cgiPid, SIGKILL); (void)::waitpid(_cgiPid, 0, WNOHANG); _cgiPid = -1; }
-			closeCgiPipes();
-			returnHttpResponse(HttpStatusCode::BadGateway);
-			return true;
+			return failCgi(HttpStatusCode::BadGateway);
 		}
-		if (revents & POLLIN) {
-			char buf[4096];
+		// POLLHUP without POLLIN means the child closed stdout: read() sees EOF
+		if (revents & (POLLIN | POLLHUP)) {
+			char buf[16384];
 			ssize_t n = ::read(_cgiOut, buf, sizeof buf);
 			if (n == 0) {
 				if (_loop) _loop->unregisterAuxFd(_cgiOut);
 				::close(_cgiOut); _cgiOut = -1;
 				if (!_cgiHeadersDone) {
-					if (_cgiPid > 0) { (void)::kill(_cgiPid, SIGKILL); (void)::waitpid(_cgiPid, 0, WNOHANG); _cgiPid = -1; }
-					closeCgiPipes();
-					returnHttpResponse(HttpStatusCode::BadGateway);
-					return true;
+					return failCgi(HttpStatusCode::BadGateway);
 				}
 
 				_cgiState = CGI_DONE;
-				(void)::waitpid(_cgiPid, 0, WNOHANG);
-				_cgiPid = -1; return true;
+				// Closing stdout usually comes just before the exit: if the
+				// child is not collectable yet it is released with the request
+				if (::waitpid(_cgiPid, 0, WNOHANG) != 0) _cgiPid = -1;
+				if (_cgiChunked) appendOutput("0\r\n\r\n", 5);
+				// A body that does not match its Content-Length desyncs the stream
+				if (_cgiContentLength >= 0 && (size_t)_cgiContentLength != _cgiOutputSent) _keepAlive = false;
+				return true;
 			}
 			if (n < 0) { return true; }
 			_t_last_active = tnow;
+			_t_cgi_active = tnow;
 			if (!_cgiHeadersDone) {
 				_cgiHdrBuf.append(buf, n);
 				std::string::size_type p = _cgiHdrBuf.find("\r\n\r\n");
 				if (p == std::string::npos) {
 					if (_cgiHdrBuf.size() > 65536) {
-						if (_cgiPid > 0) { (void)::kill(_cgiPid, SIGKILL); (void)::waitpid(_cgiPid, 0, WNOHANG); _cgiPid = -1; }
-						closeCgiPipes();
-						returnHttpResponse(HttpStatusCode::BadGateway);
+						if (!failCgi(HttpStatusCode::BadGateway)) return false;
 					}
 					return true;
 				}
@@ -1325,38 +1677,40 @@ bool Connection::onAuxEvent(int fd, short revents) {
 					size_t b=0; while (b<value.size() && (value[b]==' '||value[b]=='\t')) ++b; size_t e=value.size(); while (e>b && (value[e-1]==' '||value[e-1]=='\t')) --e; value = value.substr(b,e-b);
 					std::string lname = to_lower_copy(name);
 					if (lname == "status") { std::istringstream s(value); s >> code; }
-					else { _cgiHdrs[name] = value; }
+					else { _cgiHdrs.add(name, value); }
 				}
 				HttpResponse resp(getStatusCode(code));
-				for (std::map<std::string,std::string>::const_iterator it=_cgiHdrs.begin(); it!=_cgiHdrs.end(); ++it) resp.setHeader(it->first, it->second);
-				resp.setHeader("Connection", "close");
-				std::vector<char> head = resp.serialize();
-				_wbuf.insert(_wbuf.end(), head.begin(), head.end());
-				_status_code = code; _t_write_start = now_ms(); _cgiHeadersDone = true;
-				if (!rest.empty()) {
-					_wbuf.insert(_wbuf.end(), rest.begin(), rest.end());
-					_cgiOutputSent += rest.size();
-					if (_cgiOutputSent > CGI_OUTPUT_MAX) {
-						if (_cgiPid > 0) { (void)::kill(_cgiPid, SIGKILL); (void)::waitpid(_cgiPid, 0, WNOHANG); _cgiPid = -1; }
-						closeCgiPipes();
-						returnHttpResponse(HttpStatusCode::BadGateway);
-					}
+				for (size_t h = 0; h < _cgiHdrs.size(); ++h) {
+					const HttpHeaders::Field &f = _cgiHdrs.at(h);
+					// Framing is ours to decide
+					if (f.known == HttpHeaders::H_TRANSFER_ENCODING) continue;
+					resp.setHeader(f.name, f.value);
+				}
+				std::string cl = _cgiHdrs.get(HttpHeaders::H_CONTENT_LENGTH);
+				if (!cl.empty()) _cgiContentLength = std::strtol(cl.c_str(), 0, 10);
+				// Without a length, HTTP/1.1 clients get the body chunked as it is
+				// produced; others (and bodiless answers) see it end with the connection
+				bool noBody = _req.methodId == METHOD_HEAD || code == 204 || code == 304 || (code >= 100 && code < 200);
+				_cgiChunked = _cgiContentLength < 0 && !noBody && _req.version == "HTTP/1.1";
+				if (_cgiChunked) resp.setHeader("Transfer-Encoding", "chunked");
+				if (_cgiContentLength >= 0 || _cgiChunked) {
+					setConnectionHeader(resp);
+				} else {
+					// Body is delimited by closing the connection
+					_keepAlive = false;
+					resp.setHeader("Connection", "close");
+					resp.setCloseDelimited();
 				}
+				std::vector<char> head = resp.serialize();
+				appendOutput(head);
+				_status_code = code; markWriteStart(); _cgiHeadersDone = true;
+				appendCgiBody(rest.data(), rest.size());
+				interestChanged();
 				return true;
 			}
 			if (n > 0) {
-				if (_cgiOutputSent + (size_t)n > CGI_OUTPUT_MAX) {
-					if (_cgiPid > 0) {
-						(void)::kill(_cgiPid, SIGKILL);
-						(void)::waitpid(_cgiPid, 0, WNOHANG);
-						_cgiPid = -1;
-					}
-					closeCgiPipes();
-					returnHttpResponse(HttpStatusCode::BadGateway);
-					return true;
-				}
-				_wbuf.insert(_wbuf.end(), buf, buf + n);
-				_cgiOutputSent += (size_t)n;
+				appendCgiBody(buf, (size_t)n);
+				interestChanged();
 			}
 			return true;
 		}
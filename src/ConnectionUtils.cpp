@@ -177,6 +177,27 @@ std::string normalize_target_simple(const std::string &t) {
 	return out;
 }
 
+// Bytes of target covered by a location prefix (starting with '/'),
+// compared as the router does: implied leading '/', '\' as '/'.
+// npos when the target does not start with the prefix.
+size_t prefix_end(const std::string &target, const std::string &prefix) {
+	const size_t lead = (target.empty() || target[0] != '/') ? 1 : 0;
+	if (target.size() + lead < prefix.size()) return std::string::npos;
+	for (size_t i = lead; i < prefix.size(); ++i) {
+		char c = target[i - lead];
+		if ((c == '\\' ? '/' : c) != prefix[i]) return std::string::npos;
+	}
+	return prefix.size() - lead;
+}
+
+// The target past a location prefix ending in '/'; the slash stays with the
+// suffix. Targets outside the prefix come back whole.
+std::string location_suffix(const std::string &target, const std::string &prefix) {
+	const size_t n = prefix.empty() ? 0 : prefix.size() - 1;
+	if (n && target.size() >= n && target.compare(0, n, prefix, 0, n) == 0) return target.substr(n);
+	return target;
+}
+
 std::string base_name_only(const std::string &p) {
 	if (p.empty()) return p;
 	std::string::size_type pos = p.find_last_of("/\\");
@@ -202,6 +223,25 @@ std::string safe_filename(const std::string &s) {
 	return out;
 }
 
+// Create a hidden temp file in dir for an upload in progress; renamed into
+// place once complete. Returns the fd (path set), or -1 with errno set.
+int open_upload_temp(const std::string &dir, std::string &path) {
+	static unsigned long seq = 0;
+	for (int attempt = 0; attempt < 8; ++attempt) {
+		std::ostringstream tmp;
+		tmp << dir;
+		if (!dir.empty() && dir[dir.size() - 1] != '/') tmp << '/';
+		tmp << ".upload-" << (long)::getpid() << '-' << ++seq;
+		int fd = ::open(tmp.str().c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+		if (fd != -1) {
+			path = tmp.str();
+			return fd;
+		}
+		if (errno != EEXIST) break;
+	}
+	return -1;
+}
+
 std::string join_path_absolute(const std::string &a, const std::string &b) {
 	if (!b.empty() && b[0] == '/') return b;
 	if (a.empty()) {
@@ -231,12 +271,13 @@ std::string join_path_relative(const std::string &a, const std::string &b) {
 	return out;
 }
 
-std::string find_header_icase(const std::map<std::string, std::string> &hdrs, const std::string &name) {
-	std::string lname = to_lower_copy(name);
-	for (std::map<std::string, std::string>::const_iterator it = hdrs.begin(); it != hdrs.end(); ++it) {
-		if (to_lower_copy(it->first) == lname) return it->second;
+bool content_lengths_agree(const HttpHeaders &hdrs) {
+	size_t first = hdrs.find(HttpHeaders::H_CONTENT_LENGTH);
+	if (first == HttpHeaders::npos) return true;
+	for (size_t i = hdrs.at(first).next; i != HttpHeaders::npos; i = hdrs.at(i).next) {
+		if (hdrs.at(i).value != hdrs.at(first).value) return false;
 	}
-	return std::string();
+	return true;
 }
 
 std::string strip_port(const std::string &host) {
@@ -0,0 +1,92 @@
+#include "../inc/EpollPoller.hpp"
+
+#ifdef __linux__
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+
+static uint32_t to_epoll(short events) {
+	uint32_t ev = 0;
+	if (events & POLLIN) ev |= EPOLLIN;
+	if (events & POLLOUT) ev |= EPOLLOUT;
+	return ev;
+}
+
+static short from_epoll(uint32_t ev) {
+	short re = 0;
+	if (ev & EPOLLIN) re |= POLLIN;
+	if (ev & EPOLLOUT) re |= POLLOUT;
+	if (ev & EPOLLERR) re |= POLLERR;
+	if (ev & EPOLLHUP) re |= POLLHUP;
+	return re;
+}
+
+EpollPoller::EpollPoller() : _epfd(-1), _count(0) {}
+
+EpollPoller::~EpollPoller() {
+	if (_epfd != -1) ::close(_epfd);
+}
+
+bool EpollPoller::open(std::string *err) {
+	if (_epfd != -1) return true;
+	_epfd = ::epoll_create1(EPOLL_CLOEXEC);
+	if (_epfd == -1) {
+		if (err) *err = std::string("epoll_create1: ") + std::strerror(errno);
+		return false;
+	}
+	return true;
+}
+
+const char *EpollPoller::name() const { return "epoll"; }
+
+bool EpollPoller::add(int fd, short events) {
+	if (fd < 0 || _epfd == -1) return false;
+	if ((size_t)fd < _interest.size() && _interest[fd] != -1) return false;
+	struct epoll_event ev;
+	std::memset(&ev, 0, sizeof(ev));
+	ev.events = to_epoll(events);
+	ev.data.fd = fd;
+	if (::epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) == -1) return false;
+	if ((size_t)fd >= _interest.size()) _interest.resize(fd + 1, -1);
+	_interest[fd] = events;
+	++_count;
+	return true;
+}
+
+bool EpollPoller::modify(int fd, short events) {
+	if (fd < 0 || (size_t)fd >= _interest.size() || _interest[fd] == -1) return false;
+	if (_interest[fd] == events) return true;
+	struct epoll_event ev;
+	std::memset(&ev, 0, sizeof(ev));
+	ev.events = to_epoll(events);
+	ev.data.fd = fd;
+	if (::epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &ev) == -1) return false;
+	_interest[fd] = events;
+	return true;
+}
+
+void EpollPoller::remove(int fd) {
+	if (fd < 0 || (size_t)fd >= _interest.size() || _interest[fd] == -1) return;
+	// The fd may already be closed (kernel dropped it); ignore the result.
+	struct epoll_event ev;
+	std::memset(&ev, 0, sizeof(ev));
+	(void)::epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, &ev);
+	_interest[fd] = -1;
+	--_count;
+}
+
+int EpollPoller::wait(int timeoutMs, std::vector<Event> &out) {
+	size_t want = _count ? _count : 1;
+	if (_events.size() < want) _events.resize(want);
+	int rc = ::epoll_wait(_epfd, &_events[0], static_cast<int>(_events.size()), timeoutMs);
+	if (rc <= 0) return rc;
+	for (int i = 0; i < rc; ++i) {
+		Event ev; ev.fd = _events[i].data.fd; ev.revents = from_epoll(_events[i].events);
+		out.push_back(ev);
+	}
+	return rc;
+}
+
+#endif
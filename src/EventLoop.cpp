@@ -1,17 +1,57 @@
 #include "../inc/EventLoop.hpp"
+#include "../inc/Handoff.hpp"
+
+#include <sys/wait.h>
+
+static const uint64_t STATS_LOG_INTERVAL_MS = 10000ULL;
+
+EventLoop::EventLoop(const std::string &backend)
+		: _sigFd(-1), _reserveFd(-1), _acceptBudget(DEFAULT_ACCEPT_BUDGET), _running(false), _shuttingDown(false),
+		  _upgradeEnabled(false), _upgradePid(-1), _reusePort(false), _gen(0), _loader(0), _loaderCtx(0), _poller(0),
+		  _interestUpdates(0), _statUpdates(0), _statWindowStart(now_ms()), _statLastLog(0), _updateRate(0),
+		  _clients(0) {
+	std::string note;
+	_poller = Poller::create(backend, &note);
+	if (!note.empty()) LOG_WARNF("eventloop: %s, using %s", note.c_str(), _poller->name());
+	LOG_INFOF("eventloop: %s backend", _poller->name());
+	_reserveFd = ::open("/dev/null", O_RDONLY);
+	if (_reserveFd != -1) (void)::fcntl(_reserveFd, F_SETFD, FD_CLOEXEC);
+}
 
-EventLoop::EventLoop() : _sigFd(-1), _running(false), _shuttingDown(false) {}
 EventLoop::~EventLoop() {
-	// Cleanup any remaining connections
-	for (std::map<int, Connection*>::iterator it = _conns.begin(); it != _conns.end(); ++it) {
-		delete it->second;
+	// Cleanup any remaining connections (each unregisters its own aux fds)
+	for (size_t fd = 0; fd < _slots.size(); ++fd) {
+		if (_slots[fd].kind != SLOT_CLIENT) continue;
+		Connection *c = _slots[fd].conn;
+		_slots[fd].kind = SLOT_FREE;
+		delete c;
+		if (_slots[fd].gen) _slots[fd].gen->release();
 	}
-	_conns.clear();
+	_clients = 0;
 	// Best-effort close of any stray aux fds
-	for (std::map<int, Connection*>::iterator ait = _auxConns.begin(); ait != _auxConns.end(); ++ait) {
-		::close(ait->first);
+	for (size_t fd = 0; fd < _slots.size(); ++fd) {
+		if (_slots[fd].kind == SLOT_AUX) ::close((int)fd);
 	}
-	_auxConns.clear();
+	_slots.clear();
+	for (size_t i = 0; i < _listens.size(); ++i) delete _listens[i].owner;
+	_listens.clear();
+	if (_gen) _gen->release();
+	if (_reserveFd != -1) ::close(_reserveFd);
+	delete _poller;
+}
+
+EventLoop::Slot &EventLoop::slotFor(int fd) {
+	if ((size_t)fd >= _slots.size()) {
+		Slot empty;
+		empty.kind = SLOT_FREE; empty.dirty = 0; empty.interest = 0; empty.listen = -1; empty.conn = 0; empty.gen = 0;
+		_slots.resize(fd + 1, empty);
+	}
+	return _slots[fd];
+}
+
+EventLoop::Slot *EventLoop::slotAt(int fd, int kind) {
+	if (fd < 0 || (size_t)fd >= _slots.size() || _slots[fd].kind != kind) return 0;
+	return &_slots[fd];
 }
 
 bool EventLoop::addListen(int fd,
@@ -22,94 +62,269 @@ bool EventLoop::addListen(int fd,
 		if (err) *err = "addListen: invalid fd";
 		return false;
 	}
-	if (_listenKeys.find(fd) != _listenKeys.end()) {
+	if (slotAt(fd, SLOT_LISTEN)) {
 		if (err) *err = "addListen: fd already registered";
 		return false;
 	}
-	struct pollfd p; p.fd = fd; p.events = POLLIN; p.revents = 0;
-	_pfds.push_back(p);
-	_listenKeys[fd] = bindKey;
-	_listenGroups[fd] = group; // copy of pointers vector (cheap)
+	if (!_poller->add(fd, POLLIN)) {
+		if (err) *err = std::string("addListen: cannot watch fd: ") + std::strerror(errno);
+		return false;
+	}
+	Listen l;
+	l.fd = fd;
+	l.bindKey = bindKey;
+	l.group = group; // copy of pointers vector (cheap)
+	l.owner = 0;
+	_listens.push_back(l);
+	Slot &s = slotFor(fd);
+	s.kind = SLOT_LISTEN;
+	s.listen = (int)_listens.size() - 1;
 
 	// Register self-pipe if installed (only once)
 	if (_sigFd == -1) {
 		int sfd = SignalHandler::readFd();
-		if (sfd != -1) {
+		if (sfd != -1 && _poller->add(sfd, POLLIN)) {
 			_sigFd = sfd;
-			struct pollfd sp; sp.fd = _sigFd; sp.events = POLLIN; sp.revents = 0; _pfds.push_back(sp);
+			slotFor(sfd).kind = SLOT_SIGNAL;
 		}
 	}
 	return true;
 }
 
+int EventLoop::findListen(const std::string &bindKey) const {
+	for (size_t i = 0; i < _listens.size(); ++i) {
+		if (_listens[i].bindKey == bindKey) return (int)i;
+	}
+	return -1;
+}
+
+// Adopt a matching inherited socket if there is one, else bind a new one
+bool EventLoop::openListener(Listener *lst, const ServerConfig &sc, std::vector<int> *inherited, std::string *err) {
+	for (size_t i = 0; inherited && i < inherited->size(); ++i) {
+		std::string why;
+		if (lst->adopt((*inherited)[i], sc, &why)) {
+			inherited->erase(inherited->begin() + i);
+			return true;
+		}
+	}
+	return lst->start(sc, err, _reusePort);
+}
+
+void EventLoop::removeListen(size_t idx) {
+	Listen &l = _listens[idx];
+	_poller->remove(l.fd);
+	_slots[l.fd].kind = SLOT_FREE;
+	LOG_INFOF("eventloop: closing listener %s", l.owner ? l.owner->boundAddress().c_str() : l.bindKey.c_str());
+	delete l.owner;
+	if (idx + 1 != _listens.size()) {
+		l = _listens.back();
+		_slots[l.fd].listen = (int)idx;
+	}
+	_listens.pop_back();
+}
+
+bool EventLoop::applyConfig(ConfigGeneration *gen, std::vector<int> *inherited, std::string *err) {
+	const ConfigGeneration::BindGroups &binds = gen->binds();
+
+	// Open new addresses first so a failure leaves the running set untouched
+	std::vector<Listener*> opened;
+	std::vector<ConfigGeneration::BindGroups::const_iterator> openedBinds;
+	for (ConfigGeneration::BindGroups::const_iterator it = binds.begin(); it != binds.end(); ++it) {
+		if (it->second.empty() || findListen(it->first) != -1) continue;
+		Listener *lst = new Listener();
+		std::string emsg;
+		if (!openListener(lst, *it->second[0], inherited, &emsg)) {
+			if (err) *err = lst->boundAddress() + ": " + emsg;
+			delete lst;
+			for (size_t k = 0; k < opened.size(); ++k) delete opened[k];
+			return false;
+		}
+		opened.push_back(lst);
+		openedBinds.push_back(it);
+	}
+
+	for (size_t i = _listens.size(); i-- > 0;) {
+		ConfigGeneration::BindGroups::const_iterator it = binds.find(_listens[i].bindKey);
+		if (it == binds.end()) removeListen(i);
+		else _listens[i].group = it->second;
+	}
+	for (size_t k = 0; k < opened.size(); ++k) {
+		std::string emsg;
+		if (!addListen(opened[k]->fd(), openedBinds[k]->first, openedBinds[k]->second, &emsg)) {
+			LOG_ERRORF("eventloop: %s: %s", opened[k]->boundAddress().c_str(), emsg.c_str());
+			delete opened[k];
+			continue;
+		}
+		_listens.back().owner = opened[k];
+		LOG_INFOF("listening at %s (group size=%zu)", opened[k]->boundAddress().c_str(),
+				  openedBinds[k]->second.size());
+	}
+
+	if (_gen) _gen->release();
+	_gen = gen;
+	setAcceptBudget(static_cast<size_t>(gen->acceptBudget()));
+	return true;
+}
+
+void EventLoop::reload() {
+	if (!_loader) {
+		LOG_WARNF("reload: not supported by this process");
+		return;
+	}
+	std::string err;
+	ConfigGeneration *gen = _loader(_loaderCtx, &err);
+	if (!gen) {
+		LOG_ERRORF("reload: %s; keeping configuration generation %lu", err.c_str(), _gen ? _gen->id() : 0UL);
+		return;
+	}
+	if (!applyConfig(gen, 0, &err)) {
+		LOG_ERRORF("reload: %s; keeping configuration generation %lu", err.c_str(), _gen ? _gen->id() : 0UL);
+		gen->release();
+		return;
+	}
+	LOG_INFOF("reload: configuration generation %lu active (%zu servers, %zu listeners)",
+			  gen->id(), gen->serverCount(), _listens.size());
+}
+
 void EventLoop::stop() { _running = false; }
 
+#ifndef __linux__
 static bool set_nonblocking(int fd) {
 	int flags = ::fcntl(fd, F_GETFL, 0);
 	if (flags == -1) return false;
 	if (::fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) return false;
+	// Keep client sockets out of CGI children: a surviving dup would keep a
+	// stale registration alive in epoll after we close our copy.
+	(void)::fcntl(fd, F_SETFD, FD_CLOEXEC);
 	return true;
 }
+#endif
 
 void EventLoop::addClient(int cfd, int listenFd) {
 	// Fetch group and bind key for this listener
-	std::map<int, std::vector<const ServerConfig*> >::iterator git = _listenGroups.find(listenFd);
-	if (git == _listenGroups.end()) {
+	Slot *ls = slotAt(listenFd, SLOT_LISTEN);
+	if (!ls) {
 		::close(cfd);
 		return;
 	}
-	const std::vector<const ServerConfig*> &group = git->second;
-	const std::string &bkey = _listenKeys[listenFd];
+	const Listen &l = _listens[ls->listen];
 
-	Connection *c = new Connection(cfd, group, bkey, this);
-	struct pollfd p; p.fd = cfd; p.events = POLLIN; p.revents = 0;
-	_pfds.push_back(p);
-	_conns[cfd] = c;
-	LOG_INFOF("accept fd=%d on %s (clients=%zu)", cfd, bkey.c_str(), _conns.size());
+	if (!_poller->add(cfd, POLLIN)) {
+		LOG_ERRORF("eventloop: cannot watch client fd=%d", cfd);
+		::close(cfd);
+		return;
+	}
+	Connection *c = new Connection(cfd, l.group, l.bindKey, this);
+	Slot &s = slotFor(cfd);
+	s.kind = SLOT_CLIENT;
+	s.dirty = 0;
+	s.interest = POLLIN;
+	s.conn = c;
+	s.gen = _gen;
+	if (_gen) _gen->retain();
+	++_clients;
+	LOG_INFOF("accept fd=%d on %s (clients=%zu)", cfd, l.bindKey.c_str(), _clients);
 }
 
 void EventLoop::removeClient(int cfd) {
-	for (size_t i = 0; i < _pfds.size(); ++i) {
-		if (_pfds[i].fd == cfd) { _pfds.erase(_pfds.begin() + i); break; }
-	}
-	std::map<int, Connection*>::iterator it = _conns.find(cfd);
-	if (it != _conns.end()) {
-		Connection* victim = it->second;
-		// Unregister any aux fds owned by this connection
-		for (std::map<int, Connection*>::iterator ait = _auxConns.begin(); ait != _auxConns.end();) {
-			if (ait->second == victim) {
-				int afd = ait->first;
-				for (size_t j = 0; j < _pfds.size(); ++j) {
-					if (_pfds[j].fd == afd) { _pfds.erase(_pfds.begin() + j); break; }
-				}
-				_auxConns.erase(ait++);
-				continue;
-			}
-			++ait;
-		}
-		delete victim;
-		_conns.erase(it);
-	}
+	Slot *s = slotAt(cfd, SLOT_CLIENT);
+	if (!s) return;
+	_poller->remove(cfd);
+	_timers.cancel(cfd);
+	Connection *victim = s->conn;
+	ConfigGeneration *gen = s->gen;
+	s->kind = SLOT_FREE;
+	s->conn = 0;
+	s->gen = 0;
+	--_clients;
+	// The destructor unregisters (and closes) the connection's aux fds
+	delete victim;
+	// Last connection of a replaced generation frees it
+	if (gen) gen->release();
 }
 
+// A per-worker SO_REUSEPORT socket keeps getting its share of new SYNs for
+// as long as it is open, so it is closed; a shared one is only unwatched.
+// Closing resets whatever is still in its accept queue, so that is taken
+// in first and drained with the other connections.
 void EventLoop::disableAllListensInPoll() {
-	for (size_t i = 0; i < _pfds.size();) {
-		int fd = _pfds[i].fd;
-		if (_listenKeys.find(fd) != _listenKeys.end()) {
-			_pfds.erase(_pfds.begin() + i);
-			continue;
+	if (_reusePort) {
+		while (!_listens.empty()) {
+			size_t taken = acceptPending(_listens.back().fd, (size_t)-1);
+			if (taken) LOG_INFOF("shutdown: accepted %zu queued connections before closing", taken);
+			removeListen(_listens.size() - 1);
 		}
-		++i;
+		return;
+	}
+	for (size_t i = 0; i < _listens.size(); ++i) {
+		_poller->remove(_listens[i].fd);
+	}
+}
+
+void EventLoop::startUpgrade() {
+	if (!_upgradeEnabled) {
+		LOG_WARNF("upgrade: ignored in a worker process (signal the master)");
+		return;
+	}
+	if (_upgradePid > 0) {
+		LOG_WARNF("upgrade: already in progress (pid %d)", (int)_upgradePid);
+		return;
+	}
+	std::vector<int> fds;
+	for (size_t i = 0; i < _listens.size(); ++i) fds.push_back(_listens[i].fd);
+	std::string err;
+	_upgradePid = Handoff::spawn(fds, &err);
+	if (_upgradePid < 0) {
+		LOG_ERRORF("upgrade: %s", err.c_str());
+		return;
+	}
+	// Keep serving until the new instance signals that it took over
+	LOG_INFOF("upgrade: started pid %d with %zu listening sockets", (int)_upgradePid, fds.size());
+}
+
+// A new instance that dies before taking over must not leave us draining or a zombie
+void EventLoop::reapUpgrade() {
+	int status = 0;
+	if (::waitpid(_upgradePid, &status, WNOHANG) != _upgradePid) return;
+	LOG_ERRORF("upgrade: new instance %d exited (status %d), still serving", (int)_upgradePid,
+			   WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+	_upgradePid = -1;
+}
+
+void EventLoop::adoptChild(pid_t pid) {
+	if (pid <= 0 || ::waitpid(pid, 0, WNOHANG) != 0) return;
+	_children.push_back(pid);
+}
+
+// An exit after adoptChild() raises SIGCHLD, so nothing stays a zombie
+void EventLoop::reapChildren() {
+	size_t kept = 0;
+	for (size_t i = 0; i < _children.size(); ++i) {
+		if (::waitpid(_children[i], 0, WNOHANG) == 0) _children[kept++] = _children[i];
 	}
+	_children.resize(kept);
 }
 
 void EventLoop::handleSignalReadable(short revents) {
 	if (!(revents & POLLIN)) return;
-	SignalHandler::drain();
-	if (!_shuttingDown) {
+	int pending = SignalHandler::drain();
+	if (pending & SignalHandler::CHILD) reapChildren();
+	if ((pending & SignalHandler::RELOAD) && !_shuttingDown) reload();
+	if ((pending & SignalHandler::UPGRADE) && !_shuttingDown) startUpgrade();
+	if ((pending & SignalHandler::STOP) && !_shuttingDown) {
 		_shuttingDown = true;
-		LOG_INFOF("shutdown signal received — stopping accept and draining %zu connections", _conns.size());
+		LOG_INFOF("shutdown signal received — stopping accept and draining %zu connections", _clients);
 		disableAllListensInPoll();
+		closeIdleClients();
+	}
+}
+
+// Kept-alive connections waiting for a request would otherwise hold the
+// shutdown until their keepalive timeout
+void EventLoop::closeIdleClients() {
+	for (size_t fd = 0; fd < _slots.size(); ++fd) {
+		if (_slots[fd].kind == SLOT_CLIENT && _slots[fd].conn->isIdle())
+			removeClient((int)fd);
 	}
 }
 
@@ -121,162 +336,234 @@ void EventLoop::handleListenReadable(int lfd, short revents) {
 	}
 	if (!(revents & POLLIN)) return;
 
-	for (;;) {
-		int cfd = ::accept(lfd, 0, 0);
+	// Whatever is left over keeps the listener readable for the next tick
+	acceptPending(lfd, _acceptBudget);
+}
+
+// Accept up to budget queued clients; returns how many were added
+size_t EventLoop::acceptPending(int lfd, size_t budget) {
+	size_t added = 0;
+	for (size_t n = 0; n < budget; ++n) {
+		int cfd = acceptClient(lfd);
 		if (cfd == -1) {
 			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
-			if (errno == EINTR) continue;
+			if (errno == EINTR || errno == ECONNABORTED) continue;
 			if (errno == EMFILE || errno == ENFILE) {
-				LOG_WARNF("accept: %s, backing off...", std::strerror(errno));
-				::usleep(20000);
-				break;
+				if (!shedConnection(lfd)) break;
+				continue;
 			}
 			LOG_ERRORF("accept: %s", std::strerror(errno));
 			break;
 		}
-		(void)set_nonblocking(cfd);
 		addClient(cfd, lfd);
+		++added;
+	}
+	return added;
+}
+
+// Accept one client, already non-blocking and close-on-exec
+int EventLoop::acceptClient(int lfd) {
+#ifdef __linux__
+	return ::accept4(lfd, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+	int cfd = ::accept(lfd, 0, 0);
+	if (cfd != -1 && !set_nonblocking(cfd)) {
+		::close(cfd);
+		errno = EAGAIN;
+		return -1;
+	}
+	return cfd;
+#endif
+}
+
+// Out of fds: release the spare one, accept and immediately close the pending
+// client so it gets a reset instead of sitting in the backlog, then re-arm.
+bool EventLoop::shedConnection(int lfd) {
+	if (_reserveFd == -1) {
+		LOG_WARNF("accept: %s, no reserve fd to shed with", std::strerror(errno));
+		return false;
 	}
+	LOG_WARNF("accept: %s, shedding connection", std::strerror(errno));
+	::close(_reserveFd);
+	_reserveFd = -1;
+	int cfd = ::accept(lfd, 0, 0);
+	if (cfd != -1) ::close(cfd);
+	_reserveFd = ::open("/dev/null", O_RDONLY);
+	if (_reserveFd != -1) (void)::fcntl(_reserveFd, F_SETFD, FD_CLOEXEC);
+	return cfd != -1;
 }
 
 bool EventLoop::registerAuxFd(int fd, Connection* owner, short events) {
 	if (fd < 0 || !owner) return false;
-	if (_auxConns.find(fd) != _auxConns.end()) return false;
-	struct pollfd p; p.fd = fd; p.events = events; p.revents = 0;
-	_pfds.push_back(p);
-	_auxConns[fd] = owner;
+	if (fd < (int)_slots.size() && _slots[fd].kind != SLOT_FREE) return false;
+	if (!_poller->add(fd, events)) return false;
+	Slot &s = slotFor(fd);
+	s.kind = SLOT_AUX;
+	s.conn = owner;
 	return true;
 }
 
 void EventLoop::updateAuxFd(int fd, short events) {
-	for (size_t i = 0; i < _pfds.size(); ++i) {
-		if (_pfds[i].fd == fd) { _pfds[i].events = events; break; }
-	}
+	if (!slotAt(fd, SLOT_AUX)) return;
+	(void)_poller->modify(fd, events);
 }
 
 void EventLoop::unregisterAuxFd(int fd) {
-	for (size_t i = 0; i < _pfds.size(); ++i) {
-		if (_pfds[i].fd == fd) { _pfds.erase(_pfds.begin() + i); break; }
+	Slot *s = slotAt(fd, SLOT_AUX);
+	if (!s) return;
+	_poller->remove(fd);
+	s->kind = SLOT_FREE;
+	s->conn = 0;
+}
+
+void EventLoop::updateInterest(int cfd, Connection *c) {
+	short events = 0;
+	if (c->wantRead()) events |= POLLIN;
+	if (c->wantWrite()) events |= POLLOUT;
+	Slot &s = _slots[cfd];
+	if (s.interest == events) return;
+	if (_poller->modify(cfd, events)) {
+		s.interest = events;
+		++_interestUpdates;
+		++_statUpdates;
+	}
+}
+
+void EventLoop::markDirty(int fd) {
+	Slot *s = slotAt(fd, SLOT_CLIENT);
+	if (!s || s->dirty) return;
+	s->dirty = 1;
+	_dirty.push_back(fd);
+}
+
+void EventLoop::flushDirty() {
+	// Entries may be appended while we walk (e.g. a removal cascading); index loop is safe
+	for (size_t i = 0; i < _dirty.size(); ++i) {
+		int fd = _dirty[i];
+		Slot *s = slotAt(fd, SLOT_CLIENT);
+		if (!s || !s->dirty) continue;
+		s->dirty = 0;
+		if (s->conn->isClosed()) {
+			removeClient(fd);
+			continue;
+		}
+		updateInterest(fd, s->conn);
+	}
+	_dirty.clear();
+}
+
+void EventLoop::updateStats(uint64_t now) {
+	uint64_t elapsed = now - _statWindowStart;
+	if (elapsed < 1000) return;
+	_updateRate = (unsigned long)(_statUpdates * 1000ULL / elapsed);
+	_statUpdates = 0;
+	_statWindowStart = now;
+	if (_updateRate > 0 && now - _statLastLog >= STATS_LOG_INTERVAL_MS) {
+		LOG_INFOF("stats: %lu interest updates/s (%lu total, %zu connections)",
+				  _updateRate, _interestUpdates, _clients);
+		_statLastLog = now;
 	}
-	_auxConns.erase(fd);
 }
 
-void EventLoop::sweepTimeouts(uint64_t now) {
-	// Iterate over a copy of keys to allow erasure during iteration
-	std::vector<int> keys; keys.reserve(_conns.size());
-	for (std::map<int, Connection*>::iterator it = _conns.begin(); it != _conns.end(); ++it) keys.push_back(it->first);
-	for (size_t i = 0; i < keys.size(); ++i) {
-		int fd = keys[i];
-		std::map<int, Connection*>::iterator it = _conns.find(fd);
-		if (it == _conns.end()) continue;
-		Connection *c = it->second;
+void EventLoop::armTimer(int fd, uint64_t deadline) {
+	_timers.arm(fd, deadline);
+}
+
+void EventLoop::expireTimers(uint64_t now) {
+	// Only connections whose pending deadline has passed are touched
+	_expired.clear();
+	_timers.expire(now, _expired);
+	for (size_t i = 0; i < _expired.size(); ++i) {
+		int fd = _expired[i];
+		Slot *s = slotAt(fd, SLOT_CLIENT);
+		if (!s) continue;
+		Connection *c = s->conn;
 		if (!c->checkTimeouts(now)) {
 			// Connection requested close due to timeout drain; remove it
 			removeClient(fd);
+			continue;
 		}
+		_timers.arm(fd, c->nextDeadline());
+		markDirty(fd);
 	}
 }
 
 int EventLoop::run() {
-	// Expect at least one listener and a poll set containing it/them and optional sig fd
-	if (_listenKeys.empty() || _pfds.empty()) {
+	// Expect at least one listener registered with the backend
+	if (_listens.empty()) {
 		LOG_ERRORF("eventloop: nothing to run (no listen fds)");
 		return 2;
 	}
 
 	_running = true;
 	while (_running) {
-		int rc = ::poll(&_pfds[0], static_cast<nfds_t>(_pfds.size()), 1000); // 1s tick
+		if (_shuttingDown && _clients == 0) {
+			LOG_INFOF("shutdown complete — exiting event loop");
+			break;
+		}
+		_ready.clear();
+		// Sleep until the nearest connection deadline (or a signal/IO event)
+		int rc = _poller->wait(_timers.timeoutMs(now_ms(), -1), _ready);
 		if (rc == -1) {
 			if (errno == EINTR) continue; // interrupted by signal, retry
-			LOG_ERRORF("eventloop: poll: %s", std::strerror(errno));
+			LOG_ERRORF("eventloop: %s: %s", _poller->name(), std::strerror(errno));
 			return 2;
 		}
 		unsigned long long	now = now_ms();
-		sweepTimeouts(now);
-
-		// Refresh poll interests for all connections (important after timeouts enqueue responses)
-		for (std::map<int, Connection*>::iterator it = _conns.begin(); it != _conns.end(); ++it) {
-			int cfd = it->first;
-			Connection *c = it->second;
-			short events = 0;
-			if (c->wantRead()) events |= POLLIN;
-			if (c->wantWrite()) events |= POLLOUT;
-			for (size_t j = 0; j < _pfds.size(); ++j) {
-				if (_pfds[j].fd == cfd) { _pfds[j].events = events; break; }
-			}
-		}
-
-		if (_shuttingDown && _conns.empty()) {
-			LOG_INFOF("shutdown complete — exiting event loop");
-			break;
-		}
-		if (rc == 0) {
-			continue; // idle tick
-		}
-
-		// Take a snapshot of ready fds to avoid iterator/reference invalidation
-		std::vector< std::pair<int, short> > ready;
-		ready.reserve(_pfds.size());
-		for (size_t i = 0; i < _pfds.size(); ++i) {
-			if (_pfds[i].revents) ready.push_back(std::make_pair(_pfds[i].fd, _pfds[i].revents));
-		}
+		expireTimers(now);
+		if (_upgradePid > 0 && !_shuttingDown) reapUpgrade();
 
-		for (size_t i = 0; i < ready.size(); ++i) {
-			int fd = ready[i].first;
-			short re = ready[i].second;
+		// _ready is a snapshot, so handlers may add/remove fds while we iterate
+		for (size_t i = 0; i < _ready.size(); ++i) {
+			int fd = _ready[i].fd;
+			short re = _ready[i].revents;
 
-			if (_sigFd != -1 && fd == _sigFd) {
+			if ((size_t)fd >= _slots.size()) continue;
+			Slot &s = _slots[fd];
+			switch (s.kind) {
+			case SLOT_SIGNAL:
 				handleSignalReadable(re);
-				continue;
-			}
-			// Listener?
-			if (_listenKeys.find(fd) != _listenKeys.end()) {
+				break;
+			case SLOT_LISTEN:
 				if (!_shuttingDown) handleListenReadable(fd, re);
-				continue;
-			}
-
-			// Auxiliary (CGI) fds?
-			std::map<int, Connection*>::iterator ait = _auxConns.find(fd);
-			if (ait != _auxConns.end()) {
-				Connection *c = ait->second;
-				if (c) {
-					bool keep = c->onAuxEvent(fd, re);
-					if (!keep || c->isClosed()) {
-						unregisterAuxFd(fd);
-						if (c->isClosed()) {
-							removeClient(c->fd());
-						}
-					}
-				} else {
+				break;
+			case SLOT_AUX: {
+				// Auxiliary (CGI) fd
+				Connection *c = s.conn;
+				int cfd = c->fd(); // c->fd() is -1 once the client is closed
+				bool keep = c->onAuxEvent(fd, re);
+				if (!keep || c->isClosed()) {
 					unregisterAuxFd(fd);
+					if (c->isClosed()) {
+						removeClient(cfd);
+					}
 				}
-				continue;
-			}
-
-			std::map<int, Connection*>::iterator it = _conns.find(fd);
-			if (it == _conns.end()) continue;
-			Connection *c = it->second;
-			bool keep = true;
-			if (re & (POLLERR | POLLHUP | POLLNVAL)) {
-				keep = false;
-			} else {
-				if (re & POLLIN) keep = c->onReadable();
-				if (keep && (re & POLLOUT)) keep = c->onWritable();
+				break;
 			}
+			case SLOT_CLIENT: {
+				Connection *c = s.conn;
+				bool keep = true;
+				if (re & (POLLERR | POLLHUP | POLLNVAL)) {
+					keep = false;
+				} else {
+					if (re & POLLIN) keep = c->onReadable();
+					if (keep && (re & POLLOUT)) keep = c->onWritable();
+				}
 
-			if (!keep || c->isClosed()) {
-				removeClient(fd);
-			} else {
-				short events = 0;
-				if (c->wantRead()) events |= POLLIN;
-				if (c->wantWrite()) events |= POLLOUT;
-				// Update current pfds entry for this fd (linear search; small n)
-				for (size_t j = 0; j < _pfds.size(); ++j) {
-					if (_pfds[j].fd == fd) { _pfds[j].events = events; break; }
+				if (!keep || c->isClosed()) {
+					removeClient(fd);
+				} else {
+					updateInterest(fd, c);
 				}
+				break;
+			}
+			default:
+				break; // removed earlier in this iteration
 			}
 		}
+		// Only connections that reported a state change are revisited
+		flushDirty();
+		updateStats(now);
 	}
 	return 0;
 }
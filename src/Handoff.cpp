@@ -0,0 +1,124 @@
+#include "../inc/Handoff.hpp"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include "../inc/Logger.hpp"
+
+static const char *ENV_LISTEN_FDS = "WEBSERV_LISTEN_FDS";
+static const char *ENV_UPGRADE_FROM = "WEBSERV_UPGRADE_FROM";
+static const int LISTEN_FDS_START = 3; // sd_listen_fds(3) convention
+
+char	**Handoff::s_argv = 0;
+
+void Handoff::setArgv(char **argv) {
+	s_argv = argv;
+}
+
+// Keep inherited sockets out of CGI children until adopted (or closed)
+static bool take_fd(int fd) {
+	int flags = ::fcntl(fd, F_GETFD);
+	if (flags == -1) return false;
+	(void)::fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+	return true;
+}
+
+bool Handoff::parseFdList(const std::string &list, std::vector<int> &out, std::string *err) {
+	std::istringstream iss(list);
+	std::string item;
+	bool ok = true;
+	while (std::getline(iss, item, ',')) {
+		char *end = 0;
+		long fd = std::strtol(item.c_str(), &end, 10);
+		if (item.empty() || *end != '\0' || fd < 0 || fd > 65535 || !take_fd((int)fd)) {
+			if (err) *err = std::string("invalid or closed fd '") + item + "'";
+			ok = false;
+			continue;
+		}
+		out.push_back((int)fd);
+	}
+	return ok;
+}
+
+std::vector<int> Handoff::inheritedFds() {
+	std::vector<int> fds;
+	const char *v = std::getenv(ENV_LISTEN_FDS);
+	if (v) {
+		std::string err;
+		if (!parseFdList(v, fds, &err)) LOG_WARNF("handoff: %s: %s", ENV_LISTEN_FDS, err.c_str());
+		::unsetenv(ENV_LISTEN_FDS);
+	}
+
+	const char *n = std::getenv("LISTEN_FDS");
+	const char *pid = std::getenv("LISTEN_PID");
+	if (n) {
+		long count = std::strtol(n, 0, 10);
+		if (pid && std::strtol(pid, 0, 10) != (long)::getpid()) {
+			LOG_WARNF("handoff: LISTEN_FDS is meant for pid %s, ignoring", pid);
+		} else {
+			for (long i = 0; i < count && i < 1024; ++i) {
+				if (take_fd(LISTEN_FDS_START + (int)i)) fds.push_back(LISTEN_FDS_START + (int)i);
+				else LOG_WARNF("handoff: LISTEN_FDS fd %ld is not open", LISTEN_FDS_START + i);
+			}
+		}
+		::unsetenv("LISTEN_FDS");
+		::unsetenv("LISTEN_PID");
+		::unsetenv("LISTEN_FDNAMES");
+	}
+	return fds;
+}
+
+pid_t Handoff::upgradedFrom() {
+	const char *v = std::getenv(ENV_UPGRADE_FROM);
+	if (!v) return 0;
+	long pid = std::strtol(v, 0, 10);
+	::unsetenv(ENV_UPGRADE_FROM);
+	return pid > 1 ? (pid_t)pid : 0;
+}
+
+pid_t Handoff::spawn(const std::vector<int> &fds, std::string *err) {
+	if (!s_argv || !s_argv[0]) {
+		if (err) *err = "no command line to re-execute";
+		return -1;
+	}
+	std::ostringstream list;
+	for (size_t i = 0; i < fds.size(); ++i) list << (i ? "," : "") << fds[i];
+	std::ostringstream self;
+	self << ::getpid();
+
+	pid_t pid = ::fork();
+	if (pid < 0) {
+		if (err) *err = std::string("fork: ") + std::strerror(errno);
+		return -1;
+	}
+	if (pid == 0) {
+		for (size_t i = 0; i < fds.size(); ++i) {
+			int flags = ::fcntl(fds[i], F_GETFD);
+			if (flags != -1) (void)::fcntl(fds[i], F_SETFD, flags & ~FD_CLOEXEC);
+		}
+		if (!fds.empty()) ::setenv(ENV_LISTEN_FDS, list.str().c_str(), 1);
+		::setenv(ENV_UPGRADE_FROM, self.str().c_str(), 1);
+		sigset_t none;
+		sigemptyset(&none);
+		sigprocmask(SIG_SETMASK, &none, 0);
+		::execv(s_argv[0], s_argv);
+		const char msg[] = "webserv: upgrade: exec failed\n";
+		(void)::write(2, msg, sizeof(msg) - 1);
+		::_exit(127);
+	}
+	return pid;
+}
+
+void Handoff::notifyReady(pid_t old) {
+	if (old <= 1) return;
+	if (::kill(old, SIGTERM) == -1) {
+		LOG_WARNF("handoff: cannot signal previous instance %d: %s", (int)old, std::strerror(errno));
+		return;
+	}
+	LOG_INFOF("handoff: serving; previous instance %d is draining", (int)old);
+}
@@ -0,0 +1,182 @@
+#include "../inc/HttpHeaders.hpp"
+
+static inline char lower_ascii(char c) {
+	return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+static bool iequal(const char *a, const char *b, size_t n) {
+	for (size_t i = 0; i < n; ++i)
+		if (lower_ascii(a[i]) != lower_ascii(b[i])) return false;
+	return true;
+}
+
+// lower is already lowercase and of the same length as p
+static inline bool name_is(const char *p, size_t n, const char *lower) {
+	for (size_t i = 0; i < n; ++i)
+		if (lower_ascii(p[i]) != lower[i]) return false;
+	return true;
+}
+
+// FNV-1a over the lowercased name
+static uint32_t hash_name(const char *p, size_t n) {
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < n; ++i) {
+		h ^= (unsigned char)lower_ascii(p[i]);
+		h *= 16777619u;
+	}
+	return h;
+}
+
+HttpHeaders::HttpHeaders() : _others(0) {
+	for (size_t k = 0; k < H_KNOWN_COUNT; ++k) _known[k] = npos;
+}
+
+void HttpHeaders::clear() {
+	_fields.clear();
+	for (size_t k = 0; k < H_KNOWN_COUNT; ++k) _known[k] = npos;
+	_slots.clear();
+	_others = 0;
+}
+
+// Length and one or two letters pick the only candidate; a single
+// comparison confirms it.
+HttpHeaders::Known HttpHeaders::lookup(const char *p, size_t n) {
+	if (n < 4) return H_OTHER;
+	const char c = lower_ascii(p[0]);
+	switch (n) {
+	case 4:
+		return name_is(p, n, "host") ? H_HOST : H_OTHER;
+	case 5:
+		return name_is(p, n, "range") ? H_RANGE : H_OTHER;
+	case 6:
+		if (c == 'a') return name_is(p, n, "accept") ? H_ACCEPT : H_OTHER;
+		if (c == 'c') return name_is(p, n, "cookie") ? H_COOKIE : H_OTHER;
+		if (c == 'e') return name_is(p, n, "expect") ? H_EXPECT : H_OTHER;
+		break;
+	case 7:
+		if (c == 'u') return name_is(p, n, "upgrade") ? H_UPGRADE : H_OTHER;
+		if (c == 'r') return name_is(p, n, "referer") ? H_REFERER : H_OTHER;
+		break;
+	case 10:
+		if (c == 'c') return name_is(p, n, "connection") ? H_CONNECTION : H_OTHER;
+		if (c == 'k') return name_is(p, n, "keep-alive") ? H_KEEP_ALIVE : H_OTHER;
+		if (c == 'u') return name_is(p, n, "user-agent") ? H_USER_AGENT : H_OTHER;
+		break;
+	case 12:
+		return name_is(p, n, "content-type") ? H_CONTENT_TYPE : H_OTHER;
+	case 13:
+		if (c == 'a') return name_is(p, n, "authorization") ? H_AUTHORIZATION : H_OTHER;
+		if (c == 'i') return name_is(p, n, "if-none-match") ? H_IF_NONE_MATCH : H_OTHER;
+		break;
+	case 14:
+		return name_is(p, n, "content-length") ? H_CONTENT_LENGTH : H_OTHER;
+	case 15:
+		if (lower_ascii(p[7]) == 'e') return name_is(p, n, "accept-encoding") ? H_ACCEPT_ENCODING : H_OTHER;
+		return name_is(p, n, "accept-language") ? H_ACCEPT_LANGUAGE : H_OTHER;
+	case 17:
+		if (c == 'i') return name_is(p, n, "if-modified-since") ? H_IF_MODIFIED_SINCE : H_OTHER;
+		if (c == 't') return name_is(p, n, "transfer-encoding") ? H_TRANSFER_ENCODING : H_OTHER;
+		break;
+	}
+	return H_OTHER;
+}
+
+void HttpHeaders::add(const std::string &name, const std::string &value) {
+	add(name.data(), name.size(), value.data(), value.size());
+}
+
+void HttpHeaders::add(const char *name, size_t nameLen, const char *value, size_t valueLen) {
+	Field f;
+	f.name.assign(name, nameLen);
+	f.value.assign(value, valueLen);
+	f.known = lookup(name, nameLen);
+	f.hash = (f.known == H_OTHER) ? hash_name(name, nameLen) : 0;
+	f.next = npos;
+	f.repeat = false;
+	const size_t i = _fields.size();
+	_fields.push_back(f);
+
+	if (f.known != H_OTHER) {
+		if (_known[f.known] == npos) _known[f.known] = i;
+		else link(_known[f.known], i);
+		return;
+	}
+	size_t first = findOther(name, nameLen, f.hash);
+	if (first != npos) {
+		link(first, i);
+		return;
+	}
+	// Keep the table at most half full
+	if ((_others + 1) * 2 > _slots.size()) rehash(_slots.empty() ? 16 : _slots.size() * 2);
+	const size_t mask = _slots.size() - 1;
+	size_t j = f.hash & mask;
+	while (_slots[j]) j = (j + 1) & mask;
+	_slots[j] = i + 1;
+	++_others;
+}
+
+size_t HttpHeaders::findOther(const char *name, size_t len, uint32_t hash) const {
+	if (_slots.empty()) return npos;
+	const size_t mask = _slots.size() - 1;
+	for (size_t j = hash & mask; _slots[j]; j = (j + 1) & mask) {
+		const Field &f = _fields[_slots[j] - 1];
+		if (f.hash == hash && f.name.size() == len && iequal(f.name.data(), name, len)) return _slots[j] - 1;
+	}
+	return npos;
+}
+
+void HttpHeaders::link(size_t first, size_t i) {
+	size_t j = first;
+	while (_fields[j].next != npos) j = _fields[j].next;
+	_fields[j].next = i;
+	_fields[i].repeat = true;
+}
+
+void HttpHeaders::rehash(size_t capacity) {
+	_slots.assign(capacity, 0);
+	const size_t mask = capacity - 1;
+	for (size_t i = 0; i < _fields.size(); ++i) {
+		const Field &f = _fields[i];
+		if (f.known != H_OTHER || f.repeat) continue;
+		size_t j = f.hash & mask;
+		while (_slots[j]) j = (j + 1) & mask;
+		_slots[j] = i + 1;
+	}
+}
+
+size_t HttpHeaders::find(Known k) const {
+	return (k == H_OTHER) ? npos : _known[k];
+}
+
+size_t HttpHeaders::find(const std::string &name) const {
+	Known k = lookup(name.data(), name.size());
+	if (k != H_OTHER) return _known[k];
+	return findOther(name.data(), name.size(), hash_name(name.data(), name.size()));
+}
+
+std::string HttpHeaders::get(Known k) const {
+	size_t i = find(k);
+	return (i == npos) ? std::string() : _fields[i].value;
+}
+
+std::string HttpHeaders::get(const std::string &name) const {
+	size_t i = find(name);
+	return (i == npos) ? std::string() : _fields[i].value;
+}
+
+size_t HttpHeaders::count(Known k) const {
+	size_t n = 0;
+	for (size_t i = find(k); i != npos; i = _fields[i].next) ++n;
+	return n;
+}
+
+std::string HttpHeaders::joined(size_t i) const {
+	// Cookie pairs are separated by "; " rather than a comma (RFC 6265 5.4)
+	const char *sep = (_fields[i].known == H_COOKIE) ? "; " : ", ";
+	std::string out = _fields[i].value;
+	for (size_t j = _fields[i].next; j != npos; j = _fields[j].next) {
+		out += sep;
+		out += _fields[j].value;
+	}
+	return out;
+}
@@ -1,114 +1,244 @@
 #include "../inc/HttpParser.hpp"
 
+#include <cstring>
+
+#include "../inc/Scan.hpp"
+
+HttpMethod parse_method(const char *p, size_t n) {
+	switch (n) {
+	case 3:
+		if (std::memcmp(p, "GET", 3) == 0) return METHOD_GET;
+		if (std::memcmp(p, "PUT", 3) == 0) return METHOD_PUT;
+		break;
+	case 4:
+		if (std::memcmp(p, "HEAD", 4) == 0) return METHOD_HEAD;
+		if (std::memcmp(p, "POST", 4) == 0) return METHOD_POST;
+		break;
+	case 5:
+		if (std::memcmp(p, "PATCH", 5) == 0) return METHOD_PATCH;
+		if (std::memcmp(p, "TRACE", 5) == 0) return METHOD_TRACE;
+		break;
+	case 6:
+		if (std::memcmp(p, "DELETE", 6) == 0) return METHOD_DELETE;
+		break;
+	case 7:
+		if (std::memcmp(p, "OPTIONS", 7) == 0) return METHOD_OPTIONS;
+		if (std::memcmp(p, "CONNECT", 7) == 0) return METHOD_CONNECT;
+		break;
+	}
+	return METHOD_OTHER;
+}
+
 HttpParser::HttpParser()
-		: _errKind(ERR_NONE), _haveStartLine(false), _done(false),
-		  _maxStartLine(4096), _maxHeaderLine(8192), _maxHeaders(100) {}
+		: _pos(0), _state(S_START), _lineStart(0), _lineMax(4096), _valueEnd(0),
+		  _built(false), _errKind(ERR_NONE),
+		  _maxStartLine(4096), _maxHeaderLine(8192), _maxHeaders(100) {
+	std::memset(&_method, 0, sizeof(_method));
+	std::memset(&_target, 0, sizeof(_target));
+	std::memset(&_version, 0, sizeof(_version));
+	std::memset(&_hdr, 0, sizeof(_hdr));
+}
 
 void HttpParser::setLimits(size_t maxStartLine, size_t maxHeaderLine, size_t maxHeaders) {
 	_maxStartLine = maxStartLine;
 	_maxHeaderLine = maxHeaderLine;
 	_maxHeaders = maxHeaders;
+	if (_state == S_START) _lineMax = _maxStartLine;
+}
+
+void HttpParser::reset() {
+	_buf.clear();
+	_pos = 0;
+	_state = S_START;
+	_lineStart = 0;
+	_lineMax = _maxStartLine;
+	_headers.clear();
+	_req = HttpRequest();
+	_built = false;
+	_err.clear();
+	_errKind = ERR_NONE;
+}
+
+HttpParser::Result HttpParser::fail(ErrorKind kind, const char *msg) {
+	_state = S_ERROR;
+	_errKind = kind;
+	_err = msg;
+	return ERROR;
+}
+
+// Bulk scans stop one byte past the line limit so the check at the top of
+// the loop still sees the overlong line.
+size_t HttpParser::scanLimit(size_t n) const {
+	size_t cap = _lineStart + _lineMax + 2;
+	return n < cap ? n : cap;
 }
 
-static std::string trim(const std::string &s) {
-	size_t b = 0;
-	while (b < s.size() && (s[b] == ' ' || s[b] == '\t')) ++b;
-	size_t e = s.size();
-	while (e > b && (s[e-1] == ' ' || s[e-1] == '\t')) --e;
-	return s.substr(b, e-b);
+bool HttpParser::versionIs(const char *v) const {
+	return _version.len == std::strlen(v) && _buf.compare(_version.off, _version.len, v) == 0;
 }
 
 HttpParser::Result HttpParser::feed(const char *data, size_t len) {
-	if (_done) return OK; // idempotent after done
+	if (_state == S_DONE) return OK; // idempotent after done
+	if (_state == S_ERROR) return ERROR;
 	if (data && len) _buf.append(data, len);
 
-	// clear previous error state for this iteration
-	_err.clear();
-	_errKind = ERR_NONE;
-
-	if (!_haveStartLine) {
-		if (!parseStartLine()) {
-			if (!_err.empty()) return ERROR;
-			return NEED_MORE;
+	const char *b = _buf.data();
+	const size_t n = _buf.size();
+	for (; _pos < n; ++_pos) {
+		const unsigned char c = (unsigned char)b[_pos];
+		// A line may hold _lineMax bytes plus its CRLF
+		if (_pos - _lineStart > _lineMax + 1) {
+			if (_state <= S_RL_LF) return fail(ERR_REQUEST_LINE_TOO_LONG, "request line too long");
+			return fail(ERR_HEADER_LINE_TOO_LONG, "header line too long");
 		}
-		_haveStartLine = true;
-	}
-	if (!_done) {
-		if (!parseHeaders()) {
-			if (!_err.empty()) return ERROR;
-			return NEED_MORE;
+		switch (_state) {
+		case S_START:
+			if (c == '\r' || c == '\n') break; // counted against the request line limit
+			_method.off = _pos;
+			_state = S_METHOD;
+			// fall through
+		case S_METHOD:
+			if (c == ' ') {
+				_method.len = _pos - _method.off;
+				_state = S_SP1;
+			} else if (c == '\r' || c == '\n' || c == '\t') {
+				return fail(ERR_MALFORMED_REQUEST, "malformed request line");
+			} else if (c < 33 || c > 126) {
+				return fail(ERR_BAD_METHOD, "bad method");
+			}
+			break;
+		case S_SP1:
+			if (c == ' ') break;
+			if (c == '\r' || c == '\n') return fail(ERR_MALFORMED_REQUEST, "malformed request line");
+			_target.off = _pos;
+			_state = S_TARGET;
+			// fall through
+		case S_TARGET:
+			if (c == ' ') {
+				_target.len = _pos - _target.off;
+				_state = S_SP2;
+			} else if (c < 32 || c == 127) {
+				return fail(ERR_MALFORMED_REQUEST, "malformed request line");
+			} else {
+				_pos += scan_target_end(b + _pos, scanLimit(n) - _pos) - 1;
+			}
+			break;
+		case S_SP2:
+			if (c == ' ') break;
+			if (c == '\r' || c == '\n') return fail(ERR_MALFORMED_REQUEST, "malformed request line");
+			_version.off = _pos;
+			_state = S_VERSION;
+			// fall through
+		case S_VERSION:
+			if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+				_version.len = _pos - _version.off;
+				if (!versionIs("HTTP/1.1") && !versionIs("HTTP/1.0"))
+					return fail(ERR_BAD_VERSION, "unsupported HTTP version");
+				_state = S_RL_TAIL;
+			} else {
+				break;
+			}
+			// fall through
+		case S_RL_TAIL:
+			if (c == ' ' || c == '\t') break;
+			if (c == '\r') {
+				_state = S_RL_LF;
+				break;
+			}
+			if (c != '\n') return fail(ERR_MALFORMED_REQUEST, "malformed request line");
+			// fall through
+		case S_RL_LF:
+			if (c != '\n') return fail(ERR_MALFORMED_REQUEST, "malformed request line");
+			_state = S_HDR_START;
+			_lineStart = _pos + 1;
+			_lineMax = _maxHeaderLine;
+			break;
+		case S_HDR_START:
+			if (c == '\r') {
+				_state = S_END_LF;
+				break;
+			}
+			if (c == '\n') {
+				++_pos;
+				_state = S_DONE;
+				return OK;
+			}
+			if (c == ' ' || c == '\t') return fail(ERR_MALFORMED_HEADER, "malformed header"); // obs-fold
+			if (c == ':') return fail(ERR_EMPTY_HEADER_NAME, "empty header name");
+			_hdr.name.off = _pos;
+			_state = S_NAME;
+			// fall through
+		case S_NAME:
+			// No whitespace inside the name or before the colon (RFC 9112 5.1)
+			if (c == ':') {
+				_hdr.name.len = _pos - _hdr.name.off;
+				_state = S_VALUE_LWS;
+			} else if (c == '\r' || c == '\n') {
+				return fail(ERR_MALFORMED_HEADER, "malformed header");
+			} else {
+				size_t k = scan_token_end(b + _pos, scanLimit(n) - _pos);
+				if (k == 0) return fail(ERR_MALFORMED_HEADER, "invalid character in header name");
+				_pos += k - 1;
+			}
+			break;
+		case S_VALUE_LWS:
+			if (c == ' ' || c == '\t') break;
+			_hdr.value.off = _pos;
+			_valueEnd = _pos;
+			_state = S_VALUE;
+			// fall through
+		case S_VALUE:
+			if (c == '\r') {
+				_state = S_HDR_LF;
+				break;
+			}
+			if (c != '\n') {
+				size_t e = _pos + scan_line_end(b + _pos, scanLimit(n) - _pos);
+				size_t v = e;
+				while (v > _pos && (b[v - 1] == ' ' || b[v - 1] == '\t')) --v;
+				if (v > _pos) _valueEnd = v;
+				_pos = e - 1;
+				break;
+			}
+			// fall through
+		case S_HDR_LF:
+			if (c != '\n') return fail(ERR_MALFORMED_HEADER, "malformed header");
+			_hdr.value.len = _valueEnd - _hdr.value.off;
+			_headers.push_back(_hdr);
+			if (_headers.size() > _maxHeaders) return fail(ERR_TOO_MANY_HEADERS, "too many headers");
+			_state = S_HDR_START;
+			_lineStart = _pos + 1;
+			break;
+		case S_END_LF:
+			if (c != '\n') return fail(ERR_MALFORMED_HEADER, "malformed header");
+			++_pos;
+			_state = S_DONE;
+			return OK;
+		case S_DONE:
+		case S_ERROR:
+			break;
 		}
-		_done = true;
-		return OK;
 	}
-	return OK;
+	return NEED_MORE;
 }
 
-bool HttpParser::parseStartLine() {
-	// Find CRLF
-	std::string::size_type pos = _buf.find("\r\n");
-	if (pos == std::string::npos) {
-		if (_buf.size() > _maxStartLine) {
-			_err = "request line too long";
-			_errKind = ERR_REQUEST_LINE_TOO_LONG;
-			return false;
-		}
-		return false; // need more
-	}
-	std::string line = _buf.substr(0, pos);
-	_buf.erase(0, pos + 2);
-	if (line.size() > _maxStartLine) { _err = "request line too long"; _errKind = ERR_REQUEST_LINE_TOO_LONG; return false; }
-
-	// Split by spaces
-	std::istringstream iss(line);
-	std::string method, target, version;
-	if (!(iss >> method >> target >> version)) {
-		_err = "malformed request line";
-		_errKind = ERR_MALFORMED_REQUEST;
-		return false;
+const HttpRequest &HttpParser::request() const {
+	if (_built || _state != S_DONE) return _req;
+	_req.method.assign(_buf, _method.off, _method.len);
+	_req.methodId = parse_method(_buf.data() + _method.off, _method.len);
+	_req.target.assign(_buf, _target.off, _target.len);
+	_req.version.assign(_buf, _version.off, _version.len);
+	for (size_t i = 0; i < _headers.size(); ++i) {
+		const HeaderSlice &h = _headers[i];
+		_req.headers.add(_buf.data() + h.name.off, h.name.len, _buf.data() + h.value.off, h.value.len);
 	}
-	// Version check
-	if (!(version == "HTTP/1.1" || version == "HTTP/1.0")) {
-		_err = "unsupported HTTP version";
-		_errKind = ERR_BAD_VERSION;
-		return false;
-	}
-	// Minimal token sanity (printable, no control chars)
-	for (size_t i = 0; i < method.size(); ++i) if (method[i] < 33 || method[i] > 126) { _err = "bad method"; _errKind = ERR_BAD_METHOD; return false; }
-
-	_req.method = method;
-	_req.target = target;
-	_req.version = version;
-	return true;
+	_built = true;
+	return _req;
 }
 
-bool HttpParser::parseHeaders() {
-	size_t headers = 0;
-	while (true) {
-		std::string::size_type pos = _buf.find("\r\n");
-		if (pos == std::string::npos) {
-			if (_buf.size() > _maxHeaderLine) { _err = "header line too long"; _errKind = ERR_HEADER_LINE_TOO_LONG; return false; }
-			return false; // need more
-		}
-		if (pos == 0) {
-			// End of headers
-			_buf.erase(0, 2);
-			return true;
-		}
-		std::string line = _buf.substr(0, pos);
-		_buf.erase(0, pos + 2);
-		if (line.size() > _maxHeaderLine) { _err = "header line too long"; _errKind = ERR_HEADER_LINE_TOO_LONG; return false; }
-
-		// Parse "Name: value"
-		std::string::size_type colon = line.find(":");
-		if (colon == std::string::npos) { _err = "malformed header"; _errKind = ERR_MALFORMED_HEADER; return false; }
-		std::string name = line.substr(0, colon);
-		std::string value = line.substr(colon + 1);
-		name = trim(name);
-		value = trim(value);
-		if (name.empty()) { _err = "empty header name"; _errKind = ERR_EMPTY_HEADER_NAME; return false; }
-		_req.headers[name] = value;
-		++headers;
-		if (headers > _maxHeaders) { _err = "too many headers"; _errKind = ERR_TOO_MANY_HEADERS; return false; }
-	}
+void HttpParser::takeRemaining(std::string &out) {
+	// Slices point into _buf: make sure the request has been copied out first
+	(void)request();
+	out.assign(_buf, _pos, std::string::npos);
+	_buf.erase(_pos);
 }
@@ -1,8 +1,9 @@
 #include "../inc/HttpResponse.hpp"
 
-HttpResponse::HttpResponse() : _status_code(HttpStatusCode::OK) {}
+HttpResponse::HttpResponse() : _status_code(HttpStatusCode::OK), _fileFd(-1), _fileOffset(0), _fileLength(0), _closeDelimited(false) {}
 
-HttpResponse::HttpResponse(HttpStatusCode::e status_code) : _status_code(status_code) {}
+HttpResponse::HttpResponse(HttpStatusCode::e status_code)
+		: _status_code(status_code), _fileFd(-1), _fileOffset(0), _fileLength(0), _closeDelimited(false) {}
 
 std::string	HttpResponse::dateNow() const {
 	char		buf[64];
@@ -26,6 +27,17 @@ void	HttpResponse::setBody(const std::string &body) {
 	_body = body;
 }
 
+void	HttpResponse::setFileBody(int fd, off_t offset, size_t length) {
+	_body.clear();
+	_fileFd = fd;
+	_fileOffset = offset;
+	_fileLength = length;
+}
+
+void	HttpResponse::setCloseDelimited() {
+	_closeDelimited = true;
+}
+
 std::vector<char>	HttpResponse::serialize() const {
 	// Start with a local copy so we can inject safe defaults without mutating state
 	std::map<std::string, std::string> hdrs = _headers;
@@ -33,9 +45,9 @@ std::vector<char>	HttpResponse::serialize() const {
 	if (hdrs.find("Date") == hdrs.end()) hdrs["Date"] = dateNow();
 	if (hdrs.find("Server") == hdrs.end()) hdrs["Server"] = "webserv";
 	if (hdrs.find("Connection") == hdrs.end()) hdrs["Connection"] = "close"; // conservative default
-	if (hdrs.find("Transfer-Encoding") == hdrs.end() && hdrs.find("Content-Length") == hdrs.end()) {
+	if (!_closeDelimited && hdrs.find("Transfer-Encoding") == hdrs.end() && hdrs.find("Content-Length") == hdrs.end()) {
 		std::ostringstream cl;
-		cl << _body.size();
+		cl << (_fileFd != -1 ? _fileLength : _body.size());
 		hdrs["Content-Length"] = cl.str();
 	}
 
@@ -6,7 +6,7 @@ Listener::~Listener() throw() {
 	stop();
 }
 
-bool Listener::start(const ServerConfig &cfg, std::string *err) {
+bool Listener::start(const ServerConfig &cfg, std::string *err, bool reusePort) {
 	std::string emsg;
 	_addr = Address::fromHostPort(cfg.getHost(), cfg.getPort());
 	if (!_addr.valid()) {
@@ -15,11 +15,35 @@ bool Listener::start(const ServerConfig &cfg, std::string *err) {
 	}
 	if (!_sock.openIPv4(&emsg)) { if (err) *err = emsg; return false; }
 	if (!_sock.setReuseAddr(&emsg)) { if (err) *err = emsg; return false; }
+	if (reusePort && !_sock.setReusePort(&emsg)) { if (err) *err = emsg; return false; }
 	if (!_sock.setNonBlocking(&emsg)) { if (err) *err = emsg; return false; }
 	if (!_sock.bind(_addr, &emsg)) { if (err) *err = emsg; return false; }
 	if (!_sock.listen(128, &emsg)) { if (err) *err = emsg; return false; }
 	_listening = true;
-	std::cout << "listen: " << _addr.toString() << " [non-blocking]\n";
+	std::cout << "listen: " << _addr.toString() << (reusePort ? " [non-blocking, reuseport]\n" : " [non-blocking]\n");
+	return true;
+}
+
+bool Listener::adopt(int fd, const ServerConfig &cfg, std::string *err) {
+	Address want = Address::fromHostPort(cfg.getHost(), cfg.getPort());
+	Address got = Address::ofSocket(fd);
+	if (!got.sameAs(want)) {
+		if (err) *err = std::string("fd is bound to ") + got.toString() + ", not " + want.toString();
+		return false;
+	}
+	int accepting = 0;
+	socklen_t len = sizeof(accepting);
+	if (::getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &accepting, &len) == -1 || !accepting) {
+		if (err) *err = "fd is not a listening socket";
+		return false;
+	}
+	std::string emsg;
+	_addr = want;
+	_sock.adopt(fd);
+	if (!_sock.setNonBlocking(&emsg)) { if (err) *err = emsg; return false; }
+	(void)::fcntl(fd, F_SETFD, FD_CLOEXEC);
+	_listening = true;
+	std::cout << "listen: " << _addr.toString() << " [non-blocking, inherited fd " << fd << "]\n";
 	return true;
 }
 
@@ -1,19 +1,24 @@
 #include "../inc/Location.hpp"
+#include "../inc/ConnectionUtils.hpp"
 
-Location::Location() : autoindex(false), client_max_body_size(-1) {}
+Location::Location() : match_type(MATCH_PREFIX), allowed_mask(0), autoindex(false), client_max_body_size(-1) {}
 
 Location::Location(const Location &other)
-		: path(other.path),
+		: match_type(other.match_type),
+		  path(other.path),
 		  root(other.root),
 		  cgi_pass(other.cgi_pass),
 		  cgi_path(other.cgi_path),
 		  cgi_ext(other.cgi_ext),
 		  index(other.index),
 		  allowed_methods(other.allowed_methods),
+		  allowed_mask(other.allowed_mask),
+		  allow_header(other.allow_header),
 		  return_dir(other.return_dir),
 		  upload_store(other.upload_store),
 		  autoindex(other.autoindex),
-		  client_max_body_size(other.client_max_body_size) {}
+		  client_max_body_size(other.client_max_body_size),
+		  plan(other.plan) {}
 
 Location	&Location::operator=(Location copy) {
 	this->swap(copy);
@@ -22,7 +27,8 @@ Location	&Location::operator=(Location copy) {
 
 Location::~Location() {}
 
-Location::Location(std::vector<std::string> &conf_vec, size_t &i) : autoindex(false), client_max_body_size(-1) {
+Location::Location(std::vector<std::string> &conf_vec, size_t &i)
+		: match_type(MATCH_PREFIX), allowed_mask(0), autoindex(false), client_max_body_size(-1) {
 	parseDeclaration(conf_vec, i);
 
 	std::string trimmed_line;
@@ -45,7 +51,7 @@ Location::Location(std::vector<std::string> &conf_vec, size_t &i) : autoindex(fa
 		throw InvalidFormat("Missing '}' at end of location block.");
 }
 
-// helper function to parse the `location /path {` line
+// helper function to parse the `location [= | ^~ | ~ | ~*] /path {` line
 void	Location::parseDeclaration(std::vector<std::string> &conf_vec, size_t &i) {
 	std::istringstream	ss(conf_vec[i]);
 	std::string			keyword;
@@ -56,9 +62,20 @@ void	Location::parseDeclaration(std::vector<std::string> &conf_vec, size_t &i) {
 		throw InvalidFormat("Invalid location declaration.");
 
 	ss >> this->path;
+	if (path == "=" || path == "^~" || path == "~" || path == "~*") {
+		if (path == "=")
+			match_type = MATCH_EXACT;
+		else if (path == "^~")
+			match_type = MATCH_PREFIX_PRIORITY;
+		else
+			match_type = (path == "~") ? MATCH_REGEX : MATCH_REGEX_ICASE;
+		path.clear();
+		ss >> this->path;
+	}
 	if (path.empty() || path == "{")
 		throw InvalidFormat("Missing or invalid path in location declaration.");
-	if (path.size() > 1 && path[this->path.size() - 1] == '/')
+	if ((match_type == MATCH_PREFIX || match_type == MATCH_PREFIX_PRIORITY)
+		&& path.size() > 1 && path[this->path.size() - 1] == '/')
 		path.erase(path.size() - 1);
 
 	ss >> token;
@@ -227,13 +244,37 @@ void Location::parseAllowedMethods(std::istringstream &iss) {
 	if (!allowed_methods.empty())
 		throw InvalidFormat("Duplicate allowed_methods directive.");
 	std::string value;
-	while (iss >> value)
+	while (iss >> value) {
+		HttpMethod method = parse_method(value);
+		if (method == METHOD_OTHER)
+			throw InvalidFormat("Unknown method '" + value + "' in allowed_methods.");
 		allowed_methods.push_back(value);
+		allowed_mask |= 1u << method;
+	}
 	if (allowed_methods.empty())
 		throw InvalidFormat("allowed_methods directive requires at least one argument.");
+	buildAllowHeader();
+}
+
+// Allow only names the methods this server implements; HEAD comes with GET
+void Location::buildAllowHeader() {
+	static const HttpMethod	served[] = { METHOD_GET, METHOD_HEAD, METHOD_POST, METHOD_DELETE };
+	static const char		*names[] = { "GET", "HEAD", "POST", "DELETE" };
+
+	allow_header.clear();
+	for (size_t i = 0; i < sizeof(served) / sizeof(served[0]); i++) {
+		if (!allowsMethod(served[i]))
+			continue;
+		if (!allow_header.empty())
+			allow_header += ", ";
+		allow_header += names[i];
+	}
+	if (allow_header.empty())
+		allow_header = "GET, HEAD";
 }
 
 void Location::swap(Location &other) {
+	std::swap(this->match_type, other.match_type);
 	std::swap(this->path, other.path);
 	std::swap(this->root, other.root);
 	std::swap(this->cgi_pass, other.cgi_pass);
@@ -241,59 +282,72 @@ void Location::swap(Location &other) {
 	std::swap(this->cgi_path, other.cgi_path);
 	std::swap(this->index, other.index);
 	std::swap(this->allowed_methods, other.allowed_methods);
+	std::swap(this->allowed_mask, other.allowed_mask);
+	std::swap(this->allow_header, other.allow_header);
 	std::swap(this->return_dir, other.return_dir);
 	std::swap(this->upload_store, other.upload_store);
 	std::swap(this->autoindex, other.autoindex);
 	std::swap(this->client_max_body_size, other.client_max_body_size);
+	std::swap(this->plan, other.plan);
+}
+
+Location::MatchType	Location::getMatchType() const {
+	return this->match_type;
+}
+
+bool	Location::isRegex() const {
+	return this->match_type == MATCH_REGEX || this->match_type == MATCH_REGEX_ICASE;
 }
 
-std::string Location::getPath() const {
+const std::string &Location::getPath() const {
 	return this->path;
 }
 
-std::string Location::getRoot() const {
+const std::string &Location::getRoot() const {
 	return this->root;
 }
 
-std::string Location::getCgiPass() const {
+const std::string &Location::getCgiPass() const {
 	return this->cgi_pass;
 }
 
-std::string Location::getCgiPath() const {
+const std::string &Location::getCgiPath() const {
 	return this->cgi_path;
 }
 
-std::string	Location::getCgiExt() const {
+const std::string	&Location::getCgiExt() const {
 	return this->cgi_ext;
 }
 
-std::vector<std::string> Location::getIndex() const {
+const std::vector<std::string> &Location::getIndex() const {
 	return this->index;
 }
 
-std::vector<std::string> Location::getAllowedMethods() const {
+const std::vector<std::string> &Location::getAllowedMethods() const {
 	return this->allowed_methods;
 }
 
-std::string	Location::getMethod(const std::string method) const {
-	std::string::size_type	pos = findMethod(method);
-	if (pos == std::string::npos) return std::string();
-	return allowed_methods[pos];
+bool	Location::allowsMethod(HttpMethod method) const {
+	if (this->allowed_mask == 0)
+		return true;
+	if (method == METHOD_HEAD && listsMethod(METHOD_GET))
+		return true;
+	return listsMethod(method);
+}
+
+bool	Location::listsMethod(HttpMethod method) const {
+	return method != METHOD_OTHER && (this->allowed_mask & (1u << method)) != 0;
 }
 
-std::string::size_type	Location::findMethod(const std::string &method) const {
-	for (std::vector<std::string>::size_type i = 0; i < this->allowed_methods.size(); i++) {
-		if (this->allowed_methods[i] == method)
-			return static_cast<std::string::size_type>(i);
-	}
-	return std::string::npos;
+const std::string	&Location::getAllowHeader() const {
+	return this->allow_header;
 }
 
 ReturnDir Location::getReturnDir() const {
 	return this->return_dir;
 }
 
-std::string Location::getUploadStore() const {
+const std::string &Location::getUploadStore() const {
 	return this->upload_store;
 }
 
@@ -310,3 +364,28 @@ bool	Location::hasReturnDir() const {
 bool	Location::getAutoindex() const {
 	return autoindex;
 }
+
+void	Location::freeze(const std::string &srvRoot, const std::vector<std::string> &srvIndex, long long srvBodyLimit) {
+	plan.path.clear();
+	if (match_type == MATCH_PREFIX || match_type == MATCH_PREFIX_PRIORITY) {
+		plan.path = path;
+		if (plan.path[plan.path.size() - 1] != '/') plan.path += '/';
+	}
+	plan.root = root.empty() ? srvRoot : root;
+	plan.index = index.empty() ? srvIndex : index;
+	plan.autoindex = autoindex;
+	if (client_max_body_size >= 0)
+		plan.bodyLimit = (long)client_max_body_size;
+	else
+		plan.bodyLimit = (srvBodyLimit > 0) ? (long)srvBodyLimit : -1;
+	plan.cgi = !cgi_pass.empty();
+	plan.cgiPass = cgi_pass;
+	plan.cgiPath = cgi_path.empty() ? std::string() : join_path_absolute(plan.root, cgi_path);
+	plan.cgiExt = cgi_ext;
+	plan.uploadStore = upload_store.empty() ? std::string() : join_path_absolute(plan.root, upload_store);
+	plan.cgiByTarget = plan.cgi && cgi_path.empty() && isRegex();
+}
+
+const LocationPlan	&Location::getPlan() const {
+	return this->plan;
+}
@@ -0,0 +1,247 @@
+#include "../inc/MultipartUpload.hpp"
+
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cctype>
+#include <sys/stat.h>
+
+#include "../inc/ConnectionUtils.hpp"
+
+static const size_t MAX_BOUNDARY = 200;         // RFC 2046 allows 70
+static const size_t MAX_PART_HEADERS = 8192;
+static const size_t MAX_DELIMITER_LINE = 256;   // transport padding after a delimiter
+
+MultipartUpload::MultipartUpload() : _state(IDLE), _fd(-1) {}
+
+MultipartUpload::~MultipartUpload() {
+	abort();
+}
+
+static std::string boundary_of(const std::string &contentType) {
+	std::string lower = to_lower_copy(contentType);
+	std::string::size_type p = lower.find("boundary=");
+	if (p == std::string::npos) return std::string();
+	p += 9;
+	if (p < contentType.size() && contentType[p] == '"') {
+		std::string::size_type q = contentType.find('"', p + 1);
+		if (q == std::string::npos) return std::string();
+		return contentType.substr(p + 1, q - p - 1);
+	}
+	std::string::size_type e = p;
+	while (e < contentType.size() && contentType[e] != ';' && contentType[e] != ' ' && contentType[e] != '\t') ++e;
+	return contentType.substr(p, e - p);
+}
+
+bool MultipartUpload::begin(const std::string &store, const std::string &contentType, std::string *err) {
+	abort();
+	std::string boundary = boundary_of(contentType);
+	if (boundary.empty() || boundary.size() > MAX_BOUNDARY) {
+		if (err) *err = boundary.empty() ? "no boundary" : "boundary too long";
+		return false;
+	}
+	_store = store;
+	_delim = std::string("\r\n--") + boundary;
+	// The first delimiter may open the body without a preceding CRLF
+	_window = "\r\n";
+	_state = PREAMBLE;
+	return true;
+}
+
+bool MultipartUpload::feed(const char *data, size_t len, std::string *err, bool *badRequest) {
+	*badRequest = false;
+	if (_state == IDLE || _state == DONE) return true; // epilogue is ignored
+	_window.append(data, len);
+	size_t pos = 0;
+	bool ok = true;
+	while (ok) {
+		if (_state == PREAMBLE || _state == BODY) {
+			std::string::size_type hit = _window.find(_delim, pos);
+			size_t end = hit;
+			if (hit == std::string::npos) {
+				// Keep a tail that could be the start of a delimiter
+				size_t keep = _delim.size() - 1;
+				end = (_window.size() > pos + keep) ? _window.size() - keep : pos;
+			}
+			if (_state == BODY && end > pos) ok = writePart(_window.data() + pos, end - pos, err);
+			pos = end;
+			if (!ok || hit == std::string::npos) break;
+			pos += _delim.size();
+			if (_state == BODY) ok = endPart(err);
+			_state = DELIMITER;
+		} else if (_state == DELIMITER) {
+			if (_window.size() - pos < 2) break;
+			if (_window.compare(pos, 2, "--") == 0) {
+				_state = DONE;
+				pos = _window.size();
+				break;
+			}
+			std::string::size_type eol = _window.find("\r\n", pos);
+			if (eol == std::string::npos) {
+				if (_window.size() - pos > MAX_DELIMITER_LINE) {
+					if (err) *err = "malformed delimiter line";
+					*badRequest = true;
+					ok = false;
+				}
+				break;
+			}
+			for (size_t i = pos; i < eol && ok; ++i) {
+				if (_window[i] != ' ' && _window[i] != '\t') {
+					if (err) *err = "malformed delimiter line";
+					*badRequest = true;
+					ok = false;
+				}
+			}
+			pos = eol + 2;
+			_state = HEADERS;
+		} else if (_state == HEADERS) {
+			if (_window.size() - pos < 2) break;
+			std::string::size_type end;
+			size_t skip;
+			if (_window.compare(pos, 2, "\r\n") == 0) {
+				end = pos; // part without headers
+				skip = 2;
+			} else {
+				end = _window.find("\r\n\r\n", pos);
+				skip = 4;
+			}
+			if (end == std::string::npos) {
+				if (_window.size() - pos > MAX_PART_HEADERS) {
+					if (err) *err = "part headers too large";
+					*badRequest = true;
+					ok = false;
+				}
+				break;
+			}
+			ok = startPart(_window.substr(pos, end - pos), err);
+			pos = end + skip;
+			_state = BODY;
+		} else {
+			break;
+		}
+	}
+	_window.erase(0, pos);
+	if (!ok) abort();
+	return ok;
+}
+
+// Pick the file name out of the part's Content-Disposition; parts without
+// one (plain form fields) are skipped.
+bool MultipartUpload::startPart(const std::string &headers, std::string *err) {
+	_fd = -1;
+	std::string lower = to_lower_copy(headers);
+	std::string::size_type cd = lower.find("content-disposition:");
+	if (cd == std::string::npos) return true;
+	std::string::size_type lineEnd = lower.find("\r\n", cd);
+	if (lineEnd == std::string::npos) lineEnd = lower.size();
+	std::string::size_type fn = lower.find("filename=", cd);
+	if (fn == std::string::npos || fn > lineEnd) return true;
+
+	std::string filename;
+	std::string::size_type v = fn + 9;
+	if (v < lineEnd && headers[v] == '"') {
+		std::string::size_type q = headers.find('"', v + 1);
+		if (q == std::string::npos || q > lineEnd) q = lineEnd;
+		filename = headers.substr(v + 1, q - v - 1);
+	} else {
+		std::string::size_type e = headers.find(';', v);
+		if (e == std::string::npos || e > lineEnd) e = lineEnd;
+		size_t b = v;
+		while (b < e && (headers[b] == ' ' || headers[b] == '\t')) ++b;
+		while (e > b && (headers[e - 1] == ' ' || headers[e - 1] == '\t')) --e;
+		filename = headers.substr(b, e - b);
+	}
+	if (filename.empty()) return true;
+
+	std::string safe;
+	safe.reserve(filename.size());
+	for (size_t i = 0; i < filename.size(); i++) {
+		char c = filename[i];
+		bool ok = (std::isalnum(static_cast<unsigned char>(c)) || c == '.' || c == '_' || c == '-');
+		safe.push_back(ok ? c : '_');
+	}
+	// No hidden names: they could clash with temp files and "." / ".."
+	safe.erase(0, safe.find_first_not_of('.'));
+	if (safe.empty()) safe = "upload.bin";
+
+	std::string tmp;
+	int fd = open_upload_temp(_store, tmp);
+	if (fd == -1) {
+		if (err) *err = std::string("cannot create temp file: ") + std::strerror(errno);
+		return false;
+	}
+	File f;
+	f.name = safe;
+	f.size = 0;
+	f.existed = false;
+	_files.push_back(f);
+	_tmp.push_back(tmp);
+	_fd = fd;
+	return true;
+}
+
+bool MultipartUpload::writePart(const char *data, size_t len, std::string *err) {
+	if (_fd == -1) return true;
+	_files.back().size += len;
+	while (len > 0) {
+		ssize_t w = ::write(_fd, data, len);
+		if (w < 0 && errno == EINTR) continue;
+		if (w <= 0) {
+			if (err) *err = std::string("write failed: ") + (w < 0 ? std::strerror(errno) : "no progress");
+			return false;
+		}
+		data += w;
+		len -= (size_t)w;
+	}
+	return true;
+}
+
+bool MultipartUpload::endPart(std::string *err) {
+	if (_fd == -1) return true;
+	int fd = _fd;
+	_fd = -1;
+	if (::close(fd) != 0) {
+		if (err) *err = std::string("close failed: ") + std::strerror(errno);
+		return false;
+	}
+	return true;
+}
+
+bool MultipartUpload::finish(std::string *err, bool *badRequest) {
+	*badRequest = false;
+	if (_state != DONE || _files.empty()) {
+		if (err) *err = (_state != DONE) ? "unterminated multipart body" : "no file part found";
+		*badRequest = true;
+		abort();
+		return false;
+	}
+	for (size_t i = 0; i < _files.size(); ++i) {
+		std::string full = join_path_relative(_store, _files[i].name);
+		struct stat st;
+		if (::stat(full.c_str(), &st) == 0) _files[i].existed = S_ISREG(st.st_mode);
+		if (::rename(_tmp[i].c_str(), full.c_str()) != 0) {
+			if (err) *err = std::string("rename to ") + full + ": " + std::strerror(errno);
+			abort();
+			return false;
+		}
+		_tmp[i].clear();
+	}
+	_tmp.clear();
+	_window.clear();
+	_state = IDLE;
+	return true;
+}
+
+void MultipartUpload::abort() {
+	if (_fd != -1) {
+		::close(_fd);
+		_fd = -1;
+	}
+	for (size_t i = 0; i < _tmp.size(); ++i) {
+		if (!_tmp[i].empty()) (void)::unlink(_tmp[i].c_str());
+	}
+	_tmp.clear();
+	_files.clear();
+	_window.clear();
+	_state = IDLE;
+}
@@ -1,10 +1,10 @@
 #include "../inc/ParseConfig.hpp"
 
-ParseConfig::ParseConfig() {
+ParseConfig::ParseConfig() : workers(0), acceptBudget(0) {
 }
 
 ParseConfig::ParseConfig(const ParseConfig &copy)
-		: configs(copy.configs) {
+		: configs(copy.configs), workers(copy.workers), acceptBudget(copy.acceptBudget) {
 }
 
 ParseConfig &ParseConfig::operator=(ParseConfig copy) {
@@ -17,9 +17,11 @@ ParseConfig::~ParseConfig() {
 
 void ParseConfig::swap(ParseConfig &other) {
 	std::swap(this->configs, other.configs);
+	std::swap(this->workers, other.workers);
+	std::swap(this->acceptBudget, other.acceptBudget);
 }
 
-ParseConfig::ParseConfig(std::string file) {
+ParseConfig::ParseConfig(std::string file) : workers(0), acceptBudget(0) {
 	if (isDirectory(file))
 		throw IsDirectoryError();
 	std::ifstream	fileStream;
@@ -33,9 +35,13 @@ ParseConfig::ParseConfig(std::string file) {
 	size_t i = 0;
 	checkBrackets(conf_vec);
 	while (i < conf_vec.size()) {
+		if (parseGlobalDirective(conf_vec, i))
+			continue;
 		parseHeader(conf_vec, i);
 		parseConfigBlock(conf_vec, i);
 	}
+	if (configs.empty())
+		throw InvalidFormat("Empty file.");
 
 	fileStream.close();
 }
@@ -76,6 +82,70 @@ void ParseConfig::parseHeader(std::vector<std::string> &conf_vec, size_t &i)
 	i++;
 }
 
+bool	ParseConfig::parseGlobalDirective(std::vector<std::string> &conf_vec, size_t &i)
+{
+	std::string	line = trim(conf_vec[i]);
+	if (line.empty() || line[0] == '#') {
+		i++;
+		return true;
+	}
+	const std::string	first_word = line.substr(0, line.find_first_of(" \t{"));
+	if (first_word != "workers" && first_word != "accept_budget")
+		return false;
+
+	const size_t		semicolon_pos = findLineEnd(line);
+	std::istringstream	iss(line.substr(0, semicolon_pos));
+	std::string			var;
+	iss >> var;
+	if (var == "workers")
+		handleWorkers(iss);
+	else
+		handleAcceptBudget(iss);
+	i++;
+	return true;
+}
+
+void	ParseConfig::handleWorkers(std::istringstream &iss)
+{
+	if (this->workers != 0)
+		throw InvalidFormat("Duplicate workers directive.");
+
+	std::string	value;
+	if (!(iss >> value))
+		throw InvalidFormat("Missing value for workers.");
+
+	if (value == "auto") {
+		long	n = sysconf(_SC_NPROCESSORS_ONLN);
+		this->workers = (n > 0) ? n : 1;
+	} else {
+		char	*endptr;
+		long	n = std::strtol(value.c_str(), &endptr, 10);
+		if (endptr == value.c_str() || *endptr != '\0' || n <= 0 || n > 1024)
+			throw InvalidFormat("Invalid value for workers.");
+		this->workers = n;
+	}
+	if (iss >> value)
+		throw InvalidFormat("workers directive requires only one argument.");
+}
+
+void	ParseConfig::handleAcceptBudget(std::istringstream &iss)
+{
+	if (this->acceptBudget != 0)
+		throw InvalidFormat("Duplicate accept_budget directive.");
+
+	std::string	value;
+	if (!(iss >> value))
+		throw InvalidFormat("Missing value for accept_budget.");
+
+	char	*endptr;
+	long	n = std::strtol(value.c_str(), &endptr, 10);
+	if (endptr == value.c_str() || *endptr != '\0' || n <= 0 || n > 65536)
+		throw InvalidFormat("Invalid value for accept_budget.");
+	this->acceptBudget = n;
+	if (iss >> value)
+		throw InvalidFormat("accept_budget directive requires only one argument.");
+}
+
 void ParseConfig::parseConfigBlock(std::vector<std::string> &conf_vec, size_t &i)
 {
 	ServerConfig	config;
@@ -85,6 +155,7 @@ void ParseConfig::parseConfigBlock(std::vector<std::string> &conf_vec, size_t &i
 		if (conf_vec[i].empty() || conf_vec[i][0] == '#')
 			continue;
 		if (conf_vec[i][0] == '}') {
+			config.freezePlans();
 			this->configs.push_back(config);
 			break;
 		}
@@ -126,6 +197,10 @@ void ParseConfig::parseDirective(std::vector<std::string> &conf_vec, size_t &i,
 		handleRequestSize(iss, config);
 	else if (var == "server_name")
 		handleServerName(var, dir_args, config);
+	else if (var == "keepalive_timeout")
+		handleKeepaliveTimeout(iss, config);
+	else if (var == "keepalive_requests")
+		handleKeepaliveRequests(iss, config);
 	else if (!var.empty())
 		throw InvalidFormat("Unknown directive in server block.");
 }
@@ -137,6 +212,50 @@ void	ParseConfig::handleServerName(std::string var, std::string args, ServerConf
 	config.setServerName(extractQuotedArgs(var, args));
 }
 
+void	ParseConfig::handleKeepaliveTimeout(std::istringstream &iss, ServerConfig &config) {
+	if (config.getKeepaliveTimeout() >= 0)
+		throw InvalidFormat("Duplicate keepalive_timeout directive.");
+
+	std::string value_str;
+	if (!(iss >> value_str))
+		throw InvalidFormat("Missing value for keepalive_timeout.");
+
+	char	*endptr;
+	long long value = std::strtoll(value_str.c_str(), &endptr, 10);
+
+	if (endptr == value_str.c_str() || value < 0 || value > 3600 * 1000)
+		throw InvalidFormat("Invalid value for keepalive_timeout.");
+
+	// Seconds by default, like nginx ("75", "75s", "500ms")
+	if (*endptr == '\0' || (*endptr == 's' && *(endptr + 1) == '\0'))
+		value *= 1000;
+	else if (!(endptr[0] == 'm' && endptr[1] == 's' && endptr[2] == '\0'))
+		throw InvalidFormat("Invalid value for keepalive_timeout.");
+
+	config.setKeepaliveTimeout(value);
+	if (iss >> value_str)
+		throw InvalidFormat("keepalive_timeout directive requires only one argument.");
+}
+
+void	ParseConfig::handleKeepaliveRequests(std::istringstream &iss, ServerConfig &config) {
+	if (config.getKeepaliveRequests() >= 0)
+		throw InvalidFormat("Duplicate keepalive_requests directive.");
+
+	std::string value_str;
+	if (!(iss >> value_str))
+		throw InvalidFormat("Missing value for keepalive_requests.");
+
+	char	*endptr;
+	long long value = std::strtoll(value_str.c_str(), &endptr, 10);
+
+	if (endptr == value_str.c_str() || *endptr != '\0' || value < 0)
+		throw InvalidFormat("Invalid value for keepalive_requests.");
+
+	config.setKeepaliveRequests(value);
+	if (iss >> value_str)
+		throw InvalidFormat("keepalive_requests directive requires only one argument.");
+}
+
 void	ParseConfig::handleRequestSize(std::istringstream &iss, ServerConfig &config) {
 	if (config.getMaxHeaderSize() >= 0)
 		throw InvalidFormat("Duplicate max_request_size directive.");
@@ -315,6 +434,14 @@ std::vector<ServerConfig>	ParseConfig::getConfigs() const {
 	return (this->configs);
 }
 
+long	ParseConfig::getWorkers() const {
+	return (this->workers);
+}
+
+long	ParseConfig::getAcceptBudget() const {
+	return (this->acceptBudget);
+}
+
 const char	*ParseConfig::CouldNotOpenFile::what() const throw() {
 	return "Could not open configuration file.";
 }
@@ -0,0 +1,52 @@
+#include "../inc/PollPoller.hpp"
+
+PollPoller::PollPoller() {}
+PollPoller::~PollPoller() {}
+
+const char *PollPoller::name() const { return "poll"; }
+
+int PollPoller::indexOf(int fd) const {
+	if (fd < 0 || (size_t)fd >= _index.size()) return -1;
+	return _index[fd];
+}
+
+bool PollPoller::add(int fd, short events) {
+	if (fd < 0 || indexOf(fd) != -1) return false;
+	if ((size_t)fd >= _index.size()) _index.resize(fd + 1, -1);
+	struct pollfd p; p.fd = fd; p.events = events; p.revents = 0;
+	_index[fd] = static_cast<int>(_pfds.size());
+	_pfds.push_back(p);
+	return true;
+}
+
+bool PollPoller::modify(int fd, short events) {
+	int i = indexOf(fd);
+	if (i == -1) return false;
+	_pfds[i].events = events;
+	return true;
+}
+
+void PollPoller::remove(int fd) {
+	int i = indexOf(fd);
+	if (i == -1) return;
+	int last = static_cast<int>(_pfds.size()) - 1;
+	if (i != last) {
+		_pfds[i] = _pfds[last];
+		_index[_pfds[i].fd] = i;
+	}
+	_pfds.pop_back();
+	_index[fd] = -1;
+}
+
+int PollPoller::wait(int timeoutMs, std::vector<Event> &out) {
+	int rc = ::poll(_pfds.empty() ? 0 : &_pfds[0], static_cast<nfds_t>(_pfds.size()), timeoutMs);
+	if (rc <= 0) return rc;
+	int found = 0;
+	for (size_t i = 0; i < _pfds.size() && found < rc; ++i) {
+		if (!_pfds[i].revents) continue;
+		Event ev; ev.fd = _pfds[i].fd; ev.revents = _pfds[i].revents;
+		out.push_back(ev);
+		++found;
+	}
+	return found;
+}
@@ -0,0 +1,18 @@
+#include "../inc/Poller.hpp"
+#include "../inc/PollPoller.hpp"
+#include "../inc/EpollPoller.hpp"
+
+Poller *Poller::create(const std::string &backend, std::string *err) {
+#ifdef __linux__
+	if (backend == "auto" || backend == "epoll") {
+		EpollPoller *ep = new EpollPoller();
+		if (ep->open(err)) return ep;
+		delete ep;
+	}
+#else
+	if (backend == "epoll" && err) *err = "epoll is not available on this platform";
+#endif
+	if (backend != "auto" && backend != "epoll" && backend != "poll" && err)
+		*err = std::string("unknown event backend '") + backend + "'";
+	return new PollPoller();
+}
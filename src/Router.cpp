@@ -1,48 +1,238 @@
 #include "../inc/Router.hpp"
 
-static bool	loc_cmp(const Location *a, const Location *b) {
-	if (!a || !b) return a && !b;
-	if (a->getPath().size() != b->getPath().size()) return a->getPath().size() > b->getPath().size();
-	return a->getPath() < b->getPath(); // tie-breaker
+static const size_t NO_NODE = (size_t)-1;
+
+// Byte i of the target as matched: a missing leading '/' is implied and
+// backslashes count as '/'.
+static inline char norm_at(const std::string &t, bool lead, size_t i) {
+	char c = (lead && i == 0) ? '/' : t[i - (lead ? 1 : 0)];
+	return (c == '\\') ? '/' : c;
 }
 
-Router::Router() : _locs() {}
+static inline uint32_t fnv_step(uint32_t h, char c) {
+	return (h ^ (unsigned char)c) * 16777619u;
+}
 
-void Router::build(const ServerConfig &srv) {
-	_locs.clear();
-	const std::vector<Location>	&locs = srv.getLocationsRef();
-	_locs.reserve(locs.size());
-	for (size_t i = 0; i < locs.size(); ++i) {
-		_locs.push_back(&locs[i]);
+static uint32_t hash_path(const std::string &p) {
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < p.size(); ++i) h = fnv_step(h, p[i]);
+	return h;
+}
+
+Router::Router() : _nodes(1) {
+	_nodes[0].loc = -1;
+	_nodes[0].priority = false;
+}
+
+Router::Router(const Router &other)
+		: _nodes(other._nodes), _exact(other._exact), _exactSlots(other._exactSlots), _regex(other._regex) {
+	for (size_t i = 0; i < _regex.size(); ++i) ++_regex[i]->refs;
+}
+
+Router &Router::operator=(Router other) {
+	swap(other);
+	return *this;
+}
+
+Router::~Router() {
+	releaseRegex();
+}
+
+void Router::swap(Router &other) {
+	_nodes.swap(other._nodes);
+	_exact.swap(other._exact);
+	_exactSlots.swap(other._exactSlots);
+	_regex.swap(other._regex);
+}
+
+void Router::releaseRegex() {
+	for (size_t i = 0; i < _regex.size(); ++i) {
+		if (--_regex[i]->refs == 0) {
+			regfree(&_regex[i]->re);
+			delete _regex[i];
+		}
 	}
-	std::sort(_locs.begin(), _locs.end(), loc_cmp);
+	_regex.clear();
 }
 
-RouteMatch Router::match(const std::string &target) const {
-	RouteMatch m;
-	if (_locs.empty()) return m;
-	std::string norm = normalize_target(target);
-	for (size_t i = 0; i < _locs.size(); ++i) {
-		const Location	*loc = _locs[i];
-		if (!loc) continue;
-		const std::string &p = loc->getPath();
+void Router::build(const std::vector<Location> &locs) {
+	releaseRegex();
+	_nodes.assign(1, Node());
+	_nodes[0].loc = -1;
+	_nodes[0].priority = false;
+	_exact.clear();
+	_exactSlots.clear();
+	for (size_t i = 0; i < locs.size(); ++i) {
+		const std::string &p = locs[i].getPath();
 		if (p.empty()) continue;
-		if (norm.size() >= p.size() && norm.compare(0, p.size(), p) == 0) {
-			m.loc = loc;
-			return m;
+		switch (locs[i].getMatchType()) {
+		case Location::MATCH_EXACT: {
+			Exact e;
+			e.path = p;
+			e.hash = hash_path(p);
+			e.loc = (int)i;
+			_exact.push_back(e);
+			break;
+		}
+		case Location::MATCH_REGEX:
+		case Location::MATCH_REGEX_ICASE: {
+			Regex *r = new Regex;
+			int flags = REG_EXTENDED | REG_NOSUB;
+			if (locs[i].getMatchType() == Location::MATCH_REGEX_ICASE) flags |= REG_ICASE;
+			int rc = regcomp(&r->re, p.c_str(), flags);
+			if (rc != 0) {
+				char msg[256];
+				regerror(rc, &r->re, msg, sizeof(msg));
+				delete r;
+				throw InvalidFormat("Invalid regex in location '" + p + "': " + msg);
+			}
+			r->loc = (int)i;
+			r->refs = 1;
+			_regex.push_back(r);
+			break;
+		}
+		default:
+			insert(p, (int)i, locs[i].getMatchType() == Location::MATCH_PREFIX_PRIORITY);
+			break;
+		}
+	}
+	// Exact paths: open addressing, at most half full; the first of a path wins
+	if (_exact.empty()) return;
+	size_t cap = 8;
+	while (cap < _exact.size() * 2) cap *= 2;
+	_exactSlots.assign(cap, 0);
+	for (size_t i = 0; i < _exact.size(); ++i) {
+		size_t j = _exact[i].hash & (cap - 1);
+		bool dup = false;
+		for (; _exactSlots[j]; j = (j + 1) & (cap - 1)) {
+			if (_exact[_exactSlots[j] - 1].path == _exact[i].path) dup = true;
+		}
+		if (!dup) _exactSlots[j] = i + 1;
+	}
+}
+
+size_t Router::child(size_t node, char c) const {
+	const std::vector<size_t> &kids = _nodes[node].children;
+	for (size_t k = 0; k < kids.size(); ++k) {
+		if (_nodes[kids[k]].label[0] == c) return kids[k];
+	}
+	return NO_NODE;
+}
+
+// Standard compressed insert: follow matching edges, split an edge where the
+// path diverges from it, hang the rest of the path off the last node. The
+// first location with a given path keeps it.
+void Router::insert(const std::string &path, int loc, bool priority) {
+	size_t n = 0;
+	size_t i = 0;
+	while (i < path.size()) {
+		size_t c = child(n, path[i]);
+		if (c == NO_NODE) {
+			Node leaf;
+			leaf.label = path.substr(i);
+			leaf.loc = loc;
+			leaf.priority = priority;
+			_nodes.push_back(leaf);
+			_nodes[n].children.push_back(_nodes.size() - 1);
+			return;
+		}
+		const std::string &label = _nodes[c].label;
+		size_t common = 0;
+		while (common < label.size() && i + common < path.size() && label[common] == path[i + common]) ++common;
+		if (common < label.size()) {
+			Node mid;
+			mid.label = label.substr(0, common);
+			mid.loc = -1;
+			mid.priority = false;
+			mid.children.push_back(c);
+			_nodes[c].label.erase(0, common);
+			_nodes.push_back(mid);
+			size_t m = _nodes.size() - 1;
+			std::vector<size_t> &kids = _nodes[n].children;
+			for (size_t k = 0; k < kids.size(); ++k) {
+				if (kids[k] == c) kids[k] = m;
+			}
+			c = m;
+		}
+		n = c;
+		i += common;
+	}
+	if (_nodes[n].loc < 0) {
+		_nodes[n].loc = loc;
+		_nodes[n].priority = priority;
+	}
+}
+
+int Router::match(const std::string &target) const {
+	int loc = matchExact(target);
+	if (loc >= 0) return loc;
+	bool priority = false;
+	int prefix = matchPrefix(target, &priority);
+	if (priority) return prefix;
+	loc = matchRegex(target);
+	return (loc >= 0) ? loc : prefix;
+}
+
+// Exact and regex locations see the path without the query string
+int Router::matchExact(const std::string &target) const {
+	if (_exactSlots.empty()) return -1;
+	const bool lead = target.empty() || target[0] != '/';
+	std::string::size_type q = target.find('?');
+	const size_t len = ((q == std::string::npos) ? target.size() : q) + (lead ? 1 : 0);
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; ++i) h = fnv_step(h, norm_at(target, lead, i));
+	const size_t mask = _exactSlots.size() - 1;
+	for (size_t j = h & mask; _exactSlots[j]; j = (j + 1) & mask) {
+		const Exact &e = _exact[_exactSlots[j] - 1];
+		if (e.hash != h || e.path.size() != len) continue;
+		size_t i = 0;
+		while (i < len && e.path[i] == norm_at(target, lead, i)) ++i;
+		if (i == len) return e.loc;
+	}
+	return -1;
+}
+
+// Walks the tree once over the whole target; prefixes are plain byte
+// prefixes. Allocates nothing.
+int Router::matchPrefix(const std::string &target, bool *priority) const {
+	const bool lead = target.empty() || target[0] != '/';
+	const size_t len = target.size() + (lead ? 1 : 0);
+	int best = -1;
+	size_t n = 0;
+	size_t i = 0;
+	while (i < len) {
+		size_t next = child(n, norm_at(target, lead, i));
+		if (next == NO_NODE) break;
+		const std::string &label = _nodes[next].label;
+		if (len - i < label.size()) break;
+		size_t k = 1;
+		while (k < label.size() && label[k] == norm_at(target, lead, i + k)) ++k;
+		if (k < label.size()) break;
+		i += label.size();
+		n = next;
+		if (_nodes[n].loc >= 0) {
+			best = _nodes[n].loc;
+			*priority = _nodes[n].priority;
 		}
 	}
-	return m;
+	return best;
 }
 
-std::string	Router::normalize_target(const std::string &t) const {
-	if (t.empty()) return std::string("/");
-	std::string out; out.reserve(t.size()+1);
-	if (t[0] != '/') out.push_back('/');
-	for (size_t i = 0; i < t.size(); ++i) {
-		char c = t[i];
-		if (c == '\\') c = '/';
-		out.push_back(c);
+int Router::matchRegex(const std::string &target) const {
+	if (_regex.empty()) return -1;
+	std::string::size_type q = target.find('?');
+	const bool plain = !target.empty() && target[0] == '/' && q == std::string::npos
+		&& target.find('\\') == std::string::npos;
+	std::string path;
+	if (!plain) {
+		const bool lead = target.empty() || target[0] != '/';
+		const size_t len = ((q == std::string::npos) ? target.size() : q) + (lead ? 1 : 0);
+		path.reserve(len);
+		for (size_t i = 0; i < len; ++i) path += norm_at(target, lead, i);
+	}
+	const char *s = plain ? target.c_str() : path.c_str();
+	for (size_t i = 0; i < _regex.size(); ++i) {
+		if (regexec(&_regex[i]->re, s, 0, NULL, 0) == 0) return _regex[i]->loc;
 	}
-	return out;
+	return -1;
 }
@@ -0,0 +1,219 @@
+#include "../inc/Scan.hpp"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+# define SCAN_X86 1
+# include <immintrin.h>
+#endif
+
+// tchar = "!" / "#" / "$" / "%" / "&" / "'" / "*" / "+" / "-" / "." /
+//         "^" / "_" / "`" / "|" / "~" / DIGIT / ALPHA
+// As ranges: 21, 23-27, 2A-2B, 2D-2E, 30-39, 41-5A, 5E-7A, 7C, 7E
+static inline bool is_tchar(unsigned char c) {
+	return c == 0x21 || (c >= 0x23 && c <= 0x27) || c == 0x2a || c == 0x2b
+		|| c == 0x2d || c == 0x2e || (c >= 0x30 && c <= 0x39) || (c >= 0x41 && c <= 0x5a)
+		|| (c >= 0x5e && c <= 0x7a) || c == 0x7c || c == 0x7e;
+}
+
+static size_t line_end_scalar(const char *p, size_t n, size_t i) {
+	for (; i < n; ++i)
+		if (p[i] == '\r' || p[i] == '\n') return i;
+	return n;
+}
+
+static size_t target_end_scalar(const char *p, size_t n, size_t i) {
+	for (; i < n; ++i) {
+		unsigned char c = (unsigned char)p[i];
+		if (c <= 0x20 || c == 0x7f) return i;
+	}
+	return n;
+}
+
+static size_t token_end_scalar(const char *p, size_t n, size_t i) {
+	for (; i < n; ++i)
+		if (!is_tchar((unsigned char)p[i])) return i;
+	return n;
+}
+
+static size_t line_end_c(const char *p, size_t n) { return line_end_scalar(p, n, 0); }
+static size_t target_end_c(const char *p, size_t n) { return target_end_scalar(p, n, 0); }
+static size_t token_end_c(const char *p, size_t n) { return token_end_scalar(p, n, 0); }
+
+#ifdef SCAN_X86
+
+// Unsigned lo <= v <= hi, per byte
+static inline __m128i in_range16(__m128i v, char lo, char hi) {
+	__m128i t = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+	return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8((char)(hi - lo))), t);
+}
+
+static size_t line_end_sse2(const char *p, size_t n) {
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i lf = _mm_set1_epi8('\n');
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+		unsigned m = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+		if (m) return i + __builtin_ctz(m);
+	}
+	return line_end_scalar(p, n, i);
+}
+
+static size_t target_end_sse2(const char *p, size_t n) {
+	const __m128i sp = _mm_set1_epi8(0x20);
+	const __m128i del = _mm_set1_epi8(0x7f);
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+		__m128i stop = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, sp), v), _mm_cmpeq_epi8(v, del));
+		unsigned m = (unsigned)_mm_movemask_epi8(stop);
+		if (m) return i + __builtin_ctz(m);
+	}
+	return target_end_scalar(p, n, i);
+}
+
+static size_t token_end_sse2(const char *p, size_t n) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+		__m128i ok = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(0x21)), in_range16(v, 0x23, 0x27));
+		ok = _mm_or_si128(ok, in_range16(v, 0x2a, 0x2b));
+		ok = _mm_or_si128(ok, in_range16(v, 0x2d, 0x2e));
+		ok = _mm_or_si128(ok, in_range16(v, 0x30, 0x39));
+		ok = _mm_or_si128(ok, in_range16(v, 0x41, 0x5a));
+		ok = _mm_or_si128(ok, in_range16(v, 0x5e, 0x7a));
+		ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7c)));
+		ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7e)));
+		unsigned m = ~(unsigned)_mm_movemask_epi8(ok) & 0xffffu;
+		if (m) return i + __builtin_ctz(m);
+	}
+	return token_end_scalar(p, n, i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i in_range32(__m256i v, char lo, char hi) {
+	__m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+	return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8((char)(hi - lo))), t);
+}
+
+__attribute__((target("avx2")))
+static size_t line_end_avx2(const char *p, size_t n) {
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i lf = _mm256_set1_epi8('\n');
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+		unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+		if (m) return i + __builtin_ctz(m);
+	}
+	return line_end_scalar(p, n, i);
+}
+
+__attribute__((target("avx2")))
+static size_t target_end_avx2(const char *p, size_t n) {
+	const __m256i sp = _mm256_set1_epi8(0x20);
+	const __m256i del = _mm256_set1_epi8(0x7f);
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+		__m256i stop = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(v, sp), v), _mm256_cmpeq_epi8(v, del));
+		unsigned m = (unsigned)_mm256_movemask_epi8(stop);
+		if (m) return i + __builtin_ctz(m);
+	}
+	return target_end_scalar(p, n, i);
+}
+
+__attribute__((target("avx2")))
+static size_t token_end_avx2(const char *p, size_t n) {
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+		__m256i ok = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x21)), in_range32(v, 0x23, 0x27));
+		ok = _mm256_or_si256(ok, in_range32(v, 0x2a, 0x2b));
+		ok = _mm256_or_si256(ok, in_range32(v, 0x2d, 0x2e));
+		ok = _mm256_or_si256(ok, in_range32(v, 0x30, 0x39));
+		ok = _mm256_or_si256(ok, in_range32(v, 0x41, 0x5a));
+		ok = _mm256_or_si256(ok, in_range32(v, 0x5e, 0x7a));
+		ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7c)));
+		ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7e)));
+		unsigned m = ~(unsigned)_mm256_movemask_epi8(ok);
+		if (m) return i + __builtin_ctz(m);
+	}
+	return token_end_scalar(p, n, i);
+}
+
+#endif
+
+struct ScanKernels {
+	size_t		(*lineEnd)(const char *, size_t);
+	size_t		(*targetEnd)(const char *, size_t);
+	size_t		(*tokenEnd)(const char *, size_t);
+	const char	*name;
+};
+
+static const ScanKernels KERNELS[] = {
+#ifdef SCAN_X86
+	{ line_end_avx2, target_end_avx2, token_end_avx2, "avx2" },
+	{ line_end_sse2, target_end_sse2, token_end_sse2, "sse2" },
+#endif
+	{ line_end_c, target_end_c, token_end_c, "scalar" },
+};
+static const size_t KERNEL_COUNT = sizeof(KERNELS) / sizeof(KERNELS[0]);
+
+static bool kernel_supported(const ScanKernels &k) {
+#ifdef SCAN_X86
+	if (k.lineEnd == line_end_avx2) {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+	}
+#endif
+	(void)k;
+	return true;
+}
+
+// Widest kernel the CPU runs
+static ScanKernels pick_kernels() {
+	size_t i = 0;
+	while (!kernel_supported(KERNELS[i])) ++i;
+	return KERNELS[i];
+}
+
+static ScanKernels s_kernels = pick_kernels();
+
+size_t scan_line_end(const char *p, size_t n) {
+	return s_kernels.lineEnd(p, n);
+}
+
+size_t scan_crlf(const char *p, size_t n) {
+	size_t i = 0;
+	while (i < n) {
+		i += s_kernels.lineEnd(p + i, n - i);
+		if (i + 1 >= n) return n; // none, or a CR whose LF has not arrived
+		if (p[i] == '\r' && p[i + 1] == '\n') return i;
+		++i;
+	}
+	return n;
+}
+
+size_t scan_target_end(const char *p, size_t n) {
+	return s_kernels.targetEnd(p, n);
+}
+
+size_t scan_token_end(const char *p, size_t n) {
+	return s_kernels.tokenEnd(p, n);
+}
+
+const char *scan_kernel_name() {
+	return s_kernels.name;
+}
+
+bool scan_use_kernel(const char *name) {
+	for (size_t i = 0; i < KERNEL_COUNT; ++i) {
+		if (std::strcmp(KERNELS[i].name, name) == 0 && kernel_supported(KERNELS[i])) {
+			s_kernels = KERNELS[i];
+			return true;
+		}
+	}
+	return false;
+}
@@ -6,7 +6,9 @@ ServerConfig::ServerConfig() :
 		port(0), host(0),
 		client_max_body_size(-1),
 		max_headers_size(-1),
-		max_request_size(-1) {
+		max_request_size(-1),
+		keepalive_timeout(-1),
+		keepalive_requests(-1) {
 }
 
 ServerConfig::ServerConfig(const ServerConfig &copy)
@@ -15,10 +17,15 @@ ServerConfig::ServerConfig(const ServerConfig &copy)
 		  root(copy.root),
 		  index(copy.index),
 		  locations(copy.locations),
+		  server_name(copy.server_name),
 		  error_pages(copy.error_pages),
 		  client_max_body_size(copy.client_max_body_size),
-		  max_headers_size(copy.max_request_size),
-		  max_request_size(copy.max_request_size) {
+		  max_headers_size(copy.max_headers_size),
+		  max_request_size(copy.max_request_size),
+		  keepalive_timeout(copy.keepalive_timeout),
+		  keepalive_requests(copy.keepalive_requests),
+		  default_plan(copy.default_plan),
+		  router(copy.router) {
 }
 
 ServerConfig &ServerConfig::operator=(ServerConfig copy) {
@@ -35,8 +42,15 @@ void ServerConfig::swap(ServerConfig &other) {
 	std::swap(this->root, other.root);
 	std::swap(this->index, other.index);
 	std::swap(this->locations, other.locations);
+	std::swap(this->server_name, other.server_name);
 	std::swap(this->error_pages, other.error_pages);
 	std::swap(this->client_max_body_size, other.client_max_body_size);
+	std::swap(this->max_headers_size, other.max_headers_size);
+	std::swap(this->max_request_size, other.max_request_size);
+	std::swap(this->keepalive_timeout, other.keepalive_timeout);
+	std::swap(this->keepalive_requests, other.keepalive_requests);
+	std::swap(this->default_plan, other.default_plan);
+	std::swap(this->router, other.router);
 }
 
 
@@ -64,6 +78,14 @@ void	ServerConfig::setMaxRequestSize(long long size) {
 	this->max_request_size = size;
 }
 
+void	ServerConfig::setKeepaliveTimeout(long long ms) {
+	this->keepalive_timeout = ms;
+}
+
+void	ServerConfig::setKeepaliveRequests(long long count) {
+	this->keepalive_requests = count;
+}
+
 void ServerConfig::addIndexBack(const std::string &index) {
 	this->index.push_back(index);
 }
@@ -128,6 +150,14 @@ long long	ServerConfig::getMaxRequestSize() const {
 	return this->max_request_size;
 }
 
+long long	ServerConfig::getKeepaliveTimeout() const {
+	return this->keepalive_timeout;
+}
+
+long long	ServerConfig::getKeepaliveRequests() const {
+	return this->keepalive_requests;
+}
+
 Location	ServerConfig::findLocationForPath(std::string path) const {
 	for (size_t i = 0; i < this->locations.size(); i++) {
 		if (this->locations[i].getPath() == path)
@@ -136,6 +166,29 @@ Location	ServerConfig::findLocationForPath(std::string path) const {
 	return Location();
 }
 
+void	ServerConfig::freezePlans() {
+	for (size_t i = 0; i < this->locations.size(); i++)
+		this->locations[i].freeze(this->root, this->index, this->client_max_body_size);
+	this->default_plan = LocationPlan();
+	this->default_plan.root = this->root;
+	this->default_plan.index = this->index;
+	if (this->client_max_body_size > 0)
+		this->default_plan.bodyLimit = (long)this->client_max_body_size;
+	this->router.build(this->locations);
+}
+
+const LocationPlan	&ServerConfig::getDefaultPlan() const {
+	return this->default_plan;
+}
+
+RouteMatch	ServerConfig::route(const std::string &target) const {
+	RouteMatch	m;
+	int			i = this->router.match(target);
+	if (i >= 0)
+		m.loc = &this->locations[i];
+	return m;
+}
+
 std::string	ServerConfig::bindKey() {
 	std::ostringstream	oss;
 	oss << host << ":" << port;
@@ -20,6 +20,7 @@ static void set_nonblock(int fd) {
 	if (fd < 0) return;
 	int flags = fcntl(fd, F_GETFL, 0);
 	if (flags >= 0) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
 }
 
 bool SignalHandler::install() {
@@ -39,6 +40,16 @@ bool SignalHandler::install() {
 	sa.sa_flags = 0;
 	sigaction(SIGINT, &sa, 0);
 	sigaction(SIGTERM, &sa, 0);
+	sigaction(SIGUSR2, &sa, 0);
+	sigaction(SIGHUP, &sa, 0);
+	// Only wakes the loop to reap; interrupted calls are restarted
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigaction(SIGCHLD, &sa, 0);
+	// A peer that resets mid-response must cost one connection, not the
+	// process: writes then fail with EPIPE instead
+	sa.sa_handler = SIG_IGN;
+	sa.sa_flags = 0;
+	sigaction(SIGPIPE, &sa, 0);
 	s_installed = true;
 	return true;
 }
@@ -62,6 +73,10 @@ void SignalHandler::uninstall() {
 	sa.sa_flags = 0;
 	sigaction(SIGINT, &sa, 0);
 	sigaction(SIGTERM, &sa, 0);
+	sigaction(SIGUSR2, &sa, 0);
+	sigaction(SIGHUP, &sa, 0);
+	sigaction(SIGCHLD, &sa, 0);
+	sigaction(SIGPIPE, &sa, 0);
 
 	s_installed = false;
 }
@@ -70,19 +85,21 @@ int SignalHandler::readFd() {
 	return s_pipe[0];
 }
 
-void SignalHandler::drain() {
-	if (s_pipe[0] == -1) return;
+int SignalHandler::drain() {
+	if (s_pipe[0] == -1) return 0;
+	int pending = 0;
 	char buf[64];
 	for (;;) {
 		ssize_t n = read(s_pipe[0], buf, sizeof(buf));
 		if (n <= 0) break;
+		for (ssize_t i = 0; i < n; ++i) pending |= buf[i];
 	}
+	return pending;
 }
 
 void SignalHandler::onSignal(int signo) {
-	(void)signo;
 	if (s_pipe[1] != -1) {
-		char b = 1;
+		char b = (signo == SIGUSR2) ? UPGRADE : (signo == SIGHUP) ? RELOAD : (signo == SIGCHLD) ? CHILD : STOP;
 		// async-signal-safe write
 		(void)write(s_pipe[1], &b, 1);
 	}
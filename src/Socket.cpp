@@ -35,6 +35,24 @@ bool Socket::setReuseAddr(std::string *err) {
 	return true;
 }
 
+bool Socket::setReusePort(std::string *err) {
+	if (_fd == -1) {
+		if (err) *err = "setReusePort: socket not open";
+		return false;
+	}
+#ifdef SO_REUSEPORT
+	int enable = 1;
+	if (::setsockopt(_fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == -1) {
+		if (err) *err = std::string("setsockopt(SO_REUSEPORT): ") + std::strerror(errno);
+		return false;
+	}
+	return true;
+#else
+	if (err) *err = "setsockopt(SO_REUSEPORT): not supported on this platform";
+	return false;
+#endif
+}
+
 bool Socket::setNonBlocking(std::string *err) {
 	if (_fd == -1) {
 		if (err) *err = "setNonBlocking: socket not open";
@@ -76,6 +94,11 @@ bool Socket::listen(int backlog, std::string *err) {
 	return true;
 }
 
+void Socket::adopt(int fd) {
+	if (_fd != -1 && _fd != fd) close();
+	_fd = fd;
+}
+
 int Socket::fd() const {
 	return _fd;
 }
@@ -0,0 +1,62 @@
+#include "../inc/TimerQueue.hpp"
+
+#include <algorithm>
+
+TimerQueue::TimerQueue() : _live(0) {}
+
+bool TimerQueue::armed(int key) const {
+	return key >= 0 && (size_t)key < _deadline.size() && _deadline[key] != 0;
+}
+
+void TimerQueue::arm(int key, uint64_t deadline) {
+	if (key < 0 || deadline == 0) return;
+	if ((size_t)key >= _deadline.size()) _deadline.resize(key + 1, 0);
+	uint64_t &cur = _deadline[key];
+	if (cur != 0 && cur <= deadline) return; // an earlier check is already pending
+	if (cur == 0) ++_live;
+	cur = deadline;
+	Entry e; e.when = deadline; e.key = key;
+	_heap.push_back(e);
+	std::push_heap(_heap.begin(), _heap.end(), Later());
+}
+
+void TimerQueue::cancel(int key) {
+	if (!armed(key)) return;
+	_deadline[key] = 0; // heap entry becomes stale and is dropped lazily
+	--_live;
+	if (_live == 0) _heap.clear();
+}
+
+bool TimerQueue::isStale(const Entry &e) const {
+	return _deadline[e.key] != e.when;
+}
+
+void TimerQueue::dropStaleTop() {
+	while (!_heap.empty() && isStale(_heap.front())) {
+		std::pop_heap(_heap.begin(), _heap.end(), Later());
+		_heap.pop_back();
+	}
+}
+
+int TimerQueue::timeoutMs(uint64_t now, int maxMs) {
+	dropStaleTop();
+	if (_heap.empty()) return maxMs;
+	uint64_t when = _heap.front().when;
+	if (when <= now) return 0;
+	uint64_t wait = when - now;
+	if (maxMs >= 0 && wait > (uint64_t)maxMs) return maxMs;
+	return static_cast<int>(wait);
+}
+
+void TimerQueue::expire(uint64_t now, std::vector<int> &out) {
+	for (;;) {
+		dropStaleTop();
+		if (_heap.empty() || _heap.front().when > now) break;
+		int key = _heap.front().key;
+		std::pop_heap(_heap.begin(), _heap.end(), Later());
+		_heap.pop_back();
+		_deadline[key] = 0;
+		--_live;
+		out.push_back(key);
+	}
+}
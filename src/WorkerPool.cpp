@@ -0,0 +1,154 @@
+#include "../inc/WorkerPool.hpp"
+
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <cerrno>
+#include <cstring>
+
+#include "../inc/SignalHandler.hpp"
+#include "../inc/Handoff.hpp"
+#include "../inc/Logger.hpp"
+
+WorkerPool::WorkerPool(size_t count, WorkerMain fn, void *ctx)
+		: _count(count), _fn(fn), _ctx(ctx), _upgradePid(-1), _onReload(0) {}
+
+WorkerPool::~WorkerPool() {}
+
+// Returns the child pid in the master, 0 in the new worker, -1 on failure.
+pid_t WorkerPool::spawn(size_t slot) {
+	// Hold our signals until the worker has its own handler and self-pipe;
+	// otherwise an early signal would be written into the master's pipe and lost.
+	sigset_t block, prev;
+	sigemptyset(&block);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGTERM);
+	sigaddset(&block, SIGUSR2);
+	sigaddset(&block, SIGHUP);
+	sigprocmask(SIG_BLOCK, &block, &prev);
+	pid_t pid = ::fork();
+	if (pid == 0) {
+		SignalHandler::uninstall();
+		SignalHandler::install();
+		sigprocmask(SIG_SETMASK, &prev, 0);
+		return 0;
+	}
+	sigprocmask(SIG_SETMASK, &prev, 0);
+	if (pid < 0) {
+		LOG_ERRORF("workers: fork: %s", std::strerror(errno));
+		return -1;
+	}
+	_pids[slot] = pid;
+	LOG_INFOF("workers: started worker %lu (pid %d)", (unsigned long)slot, (int)pid);
+	return pid;
+}
+
+// Workers own their SO_REUSEPORT listeners, so the new instance simply binds
+// alongside them; once its workers are up it signals us to drain.
+void WorkerPool::upgrade() {
+	if (_upgradePid > 0) {
+		LOG_WARNF("workers: upgrade already in progress (pid %d)", (int)_upgradePid);
+		return;
+	}
+	std::string err;
+	_upgradePid = Handoff::spawn(std::vector<int>(), &err);
+	if (_upgradePid < 0) LOG_ERRORF("workers: upgrade: %s", err.c_str());
+	else LOG_INFOF("workers: upgrade: started new instance pid %d", (int)_upgradePid);
+}
+
+int WorkerPool::slotOf(pid_t pid) const {
+	for (size_t i = 0; i < _pids.size(); ++i) {
+		if (_pids[i] == pid) return static_cast<int>(i);
+	}
+	return -1;
+}
+
+void WorkerPool::signalAll(int signo) {
+	for (size_t i = 0; i < _pids.size(); ++i) {
+		if (_pids[i] > 0) (void)::kill(_pids[i], signo);
+	}
+}
+
+void WorkerPool::waitAll() {
+	for (size_t i = 0; i < _pids.size(); ++i) {
+		if (_pids[i] <= 0) continue;
+		int status = 0;
+		while (::waitpid(_pids[i], &status, 0) == -1 && errno == EINTR) {}
+		_pids[i] = -1;
+	}
+}
+
+int WorkerPool::run(bool *isWorker) {
+	*isWorker = false;
+	_pids.assign(_count, -1);
+	for (size_t i = 0; i < _count; ++i) {
+		pid_t pid = spawn(i);
+		if (pid == 0) { *isWorker = true; return _fn(_ctx); }
+		if (pid < 0) {
+			signalAll(SIGTERM);
+			waitAll();
+			return STARTUP_FAILURE;
+		}
+	}
+
+	int rc = 0;
+	bool stopping = false;
+	size_t alive = _count;
+	int sfd = SignalHandler::readFd();
+	while (!stopping && alive > 0) {
+		struct pollfd p; p.fd = sfd; p.events = POLLIN; p.revents = 0;
+		int n = ::poll(&p, sfd != -1 ? 1 : 0, 500);
+		if (n > 0 && (p.revents & POLLIN)) {
+			int pending = SignalHandler::drain();
+			if (pending & SignalHandler::RELOAD) {
+				// Each worker re-reads the configuration itself
+				LOG_INFOF("workers: reload signal received — forwarding to %lu workers", (unsigned long)_count);
+				if (_onReload) _onReload(_ctx);
+				signalAll(SIGHUP);
+			}
+			if (pending & SignalHandler::UPGRADE) upgrade();
+			if (pending & SignalHandler::STOP) {
+				LOG_INFOF("workers: shutdown signal received — draining %lu workers", (unsigned long)_count);
+				break;
+			}
+		}
+		int status = 0;
+		pid_t pid;
+		while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0) {
+			int slot = slotOf(pid);
+			if (slot < 0) {
+				if (pid == _upgradePid) {
+					LOG_ERRORF("workers: new instance %d exited before taking over, still serving", (int)pid);
+					_upgradePid = -1;
+				}
+				continue;
+			}
+			_pids[slot] = -1;
+			--alive;
+			if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+				// Clean exit: the worker drained after its own shutdown signal
+				LOG_INFOF("workers: worker %d (pid %d) stopped", slot, (int)pid);
+				continue;
+			}
+			if (WIFEXITED(status) && WEXITSTATUS(status) == STARTUP_FAILURE) {
+				LOG_ERRORF("workers: worker %d failed to start, shutting down", slot);
+				rc = STARTUP_FAILURE;
+				stopping = true;
+				continue;
+			}
+			if (stopping) continue;
+			if (WIFSIGNALED(status))
+				LOG_WARNF("workers: worker %d (pid %d) killed by signal %d, respawning", slot, (int)pid, WTERMSIG(status));
+			else
+				LOG_WARNF("workers: worker %d (pid %d) exited with %d, respawning", slot, (int)pid, WEXITSTATUS(status));
+			pid_t np = spawn(slot);
+			if (np == 0) { *isWorker = true; return _fn(_ctx); }
+			if (np > 0) ++alive;
+		}
+	}
+	signalAll(SIGTERM);
+	waitAll();
+	LOG_INFOF("workers: all workers stopped");
+	return rc;
+}
@@ -4,36 +4,136 @@
 #include "../inc/SignalHandler.hpp"
 #include "../inc/Listener.hpp"
 #include "../inc/EventLoop.hpp"
+#include "../inc/WorkerPool.hpp"
+#include "../inc/Handoff.hpp"
+#include "../inc/ConfigGeneration.hpp"
+#include "../inc/Scan.hpp"
 
 static void print_usage() {
 	std::cout << "Usage: webserv [options] [config_file]\n"
 				 "Options:\n"
-				 "  --help       Show this help and exit\n";
+				 "  --help             Show this help and exit\n"
+				 "  --backend NAME     Event backend: auto (default), epoll, poll\n"
+				 "  --workers N        Worker processes (overrides the 'workers' directive)\n"
+				 "  --inherit-fd LIST  Adopt already listening sockets (comma-separated fds)\n"
+				 "                     instead of binding; LISTEN_FDS/LISTEN_PID also work\n";
+}
+
+struct ServeContext {
+	std::string					configPath;
+	ConfigGeneration			*config;     // latest configuration (one reference)
+	std::string					backend;
+	bool						reusePort; // one SO_REUSEPORT listener set per worker
+	bool						upgradable; // SIGUSR2 handled by this loop (single-process)
+	std::vector<int>			inherited;  // listening fds handed over by a previous instance
+	pid_t						upgradeFrom; // instance to stop once we serve, 0 if none
+};
+
+// Parse the configuration file into a new generation (SIGHUP and startup).
+static ConfigGeneration *load_config(void *arg, std::string *err) {
+	ServeContext	*ctx = static_cast<ServeContext*>(arg);
+	try {
+		ParseConfig	parser(ctx->configPath);
+		return new ConfigGeneration(parser.getConfigs(), parser.getAcceptBudget());
+	}
+	catch (std::exception &e) {
+		if (err) *err = std::string(ctx->configPath) + ": " + e.what();
+		return 0;
+	}
+}
+
+// Master side of SIGHUP in worker mode: respawned workers use the new configuration.
+static void reload_master(void *arg) {
+	ServeContext		*ctx = static_cast<ServeContext*>(arg);
+	std::string			err;
+	ConfigGeneration	*gen = load_config(ctx, &err);
+	if (!gen) {
+		LOG_ERRORF("reload: %s", err.c_str());
+		return;
+	}
+	ctx->config->release();
+	ctx->config = gen;
+}
+
+// Open every listener and run one event loop until shutdown.
+// Used directly in single-process mode and as the body of each worker.
+static int serve(void *arg) {
+	ServeContext	*ctx = static_cast<ServeContext*>(arg);
+	EventLoop		loop(ctx->backend);
+	std::string		emsg;
+
+	loop.setUpgradeEnabled(ctx->upgradable);
+	loop.setReusePort(ctx->reusePort);
+	loop.setConfigLoader(load_config, ctx);
+	ctx->config->retain();
+	if (!loop.applyConfig(ctx->config, &ctx->inherited, &emsg)) {
+		std::cerr << "startup error on " << emsg << "\n";
+		ctx->config->release();
+		return WorkerPool::STARTUP_FAILURE;
+	}
+	// Sockets the new configuration no longer listens on
+	for (size_t k = 0; k < ctx->inherited.size(); ++k) {
+		LOG_WARNF("handoff: closing unused inherited fd %d", ctx->inherited[k]);
+		::close(ctx->inherited[k]);
+	}
+	ctx->inherited.clear();
+	if (ctx->upgradeFrom > 0) Handoff::notifyReady(ctx->upgradeFrom);
+	return loop.run();
 }
 
 int main(int argc, char **argv) {
 	const std::string defaultConfig = "conf_files/v0_min.conf";
 	std::string configPath;
+	std::string backend = "auto";
+	long cliWorkers = 0;
+	std::vector<int> cliFds;
 
-	if (argc == 1) {
-		configPath = defaultConfig;
-	} else if (argc == 2) {
-		std::string arg = argv[1];
-		if (arg == std::string("--help")) {
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--help") {
 			print_usage();
 			return 0;
-		} else {
+		} else if (arg == "--backend") {
+			if (i + 1 >= argc) {
+				std::cerr << "error: --backend requires a value\n";
+				print_usage();
+				return 2;
+			}
+			backend = argv[++i];
+		} else if (arg == "--workers") {
+			char *end = 0;
+			if (i + 1 < argc) cliWorkers = std::strtol(argv[++i], &end, 10);
+			if (!end || *end != '\0' || cliWorkers <= 0 || cliWorkers > 1024) {
+				std::cerr << "error: --workers requires a count between 1 and 1024\n";
+				print_usage();
+				return 2;
+			}
+		} else if (arg == "--inherit-fd") {
+			std::string emsg = "missing value";
+			if (i + 1 >= argc || !Handoff::parseFdList(argv[++i], cliFds, &emsg)) {
+				std::cerr << "error: --inherit-fd: " << emsg << "\n";
+				print_usage();
+				return 2;
+			}
+		} else if (arg.size() > 1 && arg[0] == '-') {
+			std::cerr << "error: unknown option " << arg << "\n";
+			print_usage();
+			return 2;
+		} else if (configPath.empty()) {
 			configPath = arg;
+		} else {
+			std::cerr << "error: too many arguments\n";
+			print_usage();
+			return 2; // CLI error
 		}
-	} else {
-		std::cerr << "error: too many arguments\n";
-		print_usage();
-		return 2; // CLI error
 	}
+	if (configPath.empty()) configPath = defaultConfig;
+	Handoff::setArgv(argv);
 
 	try {
 		Logger::init("logs/access.log", "logs/error.log");
 		Logger::setLevel(LOG_INFO);
+		LOG_INFOF("parser: %s header scanning", scan_kernel_name());
 		SignalHandler	signal;
 		std::cout << "webserv — running (multi-listen event loop)" << std::endl;
 		std::cout << "Loading config: " << configPath << std::endl;
@@ -44,51 +144,27 @@ int main(int argc, char **argv) {
 			return 3;
 		}
 
-		// Build bind groups: key -> indices of servers (order preserved; first is default)
-		std::map<std::string, std::vector<size_t> >	binds;
-		for (size_t i = 0; i < configs.size(); i++) {
-			ServerConfig	&sc = configs[i];
-			std::string		key = sc.bindKey();
-			binds[key].push_back(i);
-		}
-
-		// Start listeners
-		std::vector<Listener*>	listeners;
-		listeners.reserve(binds.size());
-		EventLoop	loop;
-		std::string	emsg;
-
-		for (std::map<std::string, std::vector<size_t> >::const_iterator it = binds.begin(); it != binds.end(); ++it) {
-			const std::string &key = it->first;
-			const std::vector<size_t> &idxs = it->second;
-			if (idxs.empty()) continue;
-
-			Listener *lst = new Listener();
-			const ServerConfig &sc0 = configs[idxs[0]]; // default for this bind
-			if (!lst->start(sc0, &emsg)) {
-				std::cerr << "startup error on " << key << ": " << emsg << "\n";
-				// cleanup
-				for (size_t k = 0; k < listeners.size(); ++k) { delete listeners[k]; }
-				delete lst;
-				return 2;
-			}
-			listeners.push_back(lst);
-
-			// Build group of pointers for this bind
-			std::vector<const ServerConfig*> group;
-			for (size_t j = 0; j < idxs.size(); ++j) {
-				group.push_back(&configs[idxs[j]]);
-			}
-
-			if (!loop.addListen(lst->fd(), key, group, &emsg)) {
-				std::cerr << "eventloop setup error for " << key << ": " << emsg << "\n";
-				for (size_t k = 0; k < listeners.size(); ++k) { delete listeners[k]; }
-				return 2;
-			}
-			std::cout << "listening at " << lst->boundAddress() << " (group size=" << group.size() << ")\n";
+		long workers = (cliWorkers > 0) ? cliWorkers : parser.getWorkers();
+		ServeContext	ctx;
+		ctx.configPath = configPath;
+		ctx.config = new ConfigGeneration(configs, parser.getAcceptBudget());
+		ctx.backend = backend;
+		ctx.reusePort = workers > 1;
+		ctx.upgradable = workers <= 1;
+		ctx.inherited = Handoff::inheritedFds();
+		ctx.inherited.insert(ctx.inherited.end(), cliFds.begin(), cliFds.end());
+		ctx.upgradeFrom = Handoff::upgradedFrom();
+		int rc;
+		if (workers > 1) {
+			std::cout << "starting " << workers << " worker processes" << std::endl;
+			WorkerPool	pool(static_cast<size_t>(workers), serve, &ctx);
+			pool.setReloadHook(reload_master);
+			bool		isWorker = false;
+			rc = pool.run(&isWorker);
+		} else {
+			rc = serve(&ctx);
 		}
-		int rc = loop.run();
-		for (size_t k = 0; k < listeners.size(); ++k) { delete listeners[k]; }
+		ctx.config->release();
 		Logger::shutdown();
 		return rc;
 	}
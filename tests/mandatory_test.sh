@@ -0,0 +1,52 @@
+#!/bin/bash
+# Request-level checks against a local server (make test)
+cd "$(dirname "$0")/.." || exit 1
+
+CONF=conf_files/v0_min.conf
+PORT=8080
+
+./webserv "$CONF" >/dev/null 2>&1 &
+PID=$!
+trap 'kill $PID 2>/dev/null' EXIT
+sleep 0.5
+
+fail=0
+
+# Sends a raw request and prints the status code of the response
+status() {
+	python3 - "$PORT" "$1" 2>/dev/null <<'PY'
+import socket, sys
+s = socket.create_connection(("127.0.0.1", int(sys.argv[1])), timeout=5)
+s.sendall(sys.argv[2].encode().decode("unicode_escape").encode("latin-1"))
+line = s.makefile("rb").readline().split()
+print(line[1].decode() if len(line) > 1 else "")
+PY
+}
+
+expect() {
+	local got
+	got=$(status "$2")
+	if [ "$got" = "$3" ]; then
+		echo "ok   $1"
+	else
+		echo "FAIL $1: got '$got', want '$3'"
+		fail=1
+	fi
+}
+
+expect "GET /"                 'GET / HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n' 200
+expect "HEAD /"                'HEAD / HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n' 200
+expect "missing file"          'GET /nope HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n' 404
+expect "unknown method"        'BREW / HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n' 501
+expect "bad version"           'GET / HTTP/2.0\r\nHost: a\r\nConnection: close\r\n\r\n' 400
+expect "duplicate Host"        'GET / HTTP/1.1\r\nHost: a\r\nHost: b\r\nConnection: close\r\n\r\n' 400
+expect "Content-Length clash"  'POST / HTTP/1.1\r\nHost: a\r\nContent-Length: 1\r\nContent-Length: 2\r\nConnection: close\r\n\r\nx' 400
+expect "obs-fold"              'GET / HTTP/1.1\r\nHost: a\r\n x\r\nConnection: close\r\n\r\n' 400
+# Whitespace in a field name or before the colon (RFC 9112 5.1)
+expect "space in name"         'GET / HTTP/1.1\r\nHo st: a\r\nConnection: close\r\n\r\n' 400
+expect "space before colon"    'POST / HTTP/1.1\r\nHost: a\r\nContent-Length : 5\r\nConnection: close\r\n\r\nhello' 400
+expect "tab before colon"      'GET / HTTP/1.1\r\nHost\t: a\r\nConnection: close\r\n\r\n' 400
+
+kill $PID
+wait $PID 2>/dev/null
+exit $fail